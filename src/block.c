@@ -0,0 +1,663 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ell/ell.h>
+
+#include <modbus.h>
+
+#include "driver.h"
+#include "source.h"
+#include "devlimits.h"
+#include "image.h"
+#include "block.h"
+
+struct block {
+	int table;		/* Register table: modbus_table */
+	uint16_t address;	/* First bit or register */
+	uint16_t size;		/* Number of bits or registers */
+	uint16_t interval;	/* Polling interval in ms */
+	uint16_t max_interval;	/* Adaptive: upper bound, 0 if disabled */
+	uint16_t period;	/* Adaptive: current interval */
+	bool aligned;		/* Polling phase not spread */
+	int priority;		/* Request class */
+	const char *snapshot;	/* Snapshot group: owned by the sources */
+	int trigger_table;	/* Trigger source table: modbus_table */
+	uint16_t trigger;	/* Trigger source address or 0xffff */
+	uint64_t trigger_mask;	/* Trigger value mask: 0 for any change */
+	struct l_queue *source_list;	/* Sources decoded from this block */
+	struct l_queue *peer_list;	/* Overlapping sources of others */
+	void *buffer;		/* Response: packed bits or u16 */
+};
+
+static int snapshot_cmp(const char *name1, const char *name2)
+{
+	if (!name1 || !name2)
+		return (name1 ? 1 : 0) - (name2 ? 1 : 0);
+
+	return strcmp(name1, name2);
+}
+
+static int source_cmp(const void *a, const void *b)
+{
+	const struct source *source1 = *((const struct source **) a);
+	const struct source *source2 = *((const struct source **) b);
+	int table1 = source_get_table(source1);
+	int table2 = source_get_table(source2);
+	bool aligned1 = source_get_phase_aligned(source1);
+	bool aligned2 = source_get_phase_aligned(source2);
+	int ret;
+
+	/*
+	 * Group by function code, class, snapshot, trigger, phase,
+	 * interval and address.
+	 */
+	if (table1 != table2)
+		return table1 - table2;
+
+	if (source_get_priority(source1) != source_get_priority(source2))
+		return source_get_priority(source1) -
+			source_get_priority(source2);
+
+	ret = snapshot_cmp(source_get_snapshot(source1),
+			   source_get_snapshot(source2));
+	if (ret)
+		return ret;
+
+	if (source_get_trigger_table(source1) !=
+	    source_get_trigger_table(source2))
+		return source_get_trigger_table(source1) -
+			source_get_trigger_table(source2);
+
+	if (source_get_trigger(source1) != source_get_trigger(source2))
+		return source_get_trigger(source1) -
+			source_get_trigger(source2);
+
+	if (source_get_trigger_mask(source1) !=
+	    source_get_trigger_mask(source2))
+		return (source_get_trigger_mask(source1) <
+			source_get_trigger_mask(source2) ? -1 : 1);
+
+	if (aligned1 != aligned2)
+		return (aligned1 ? -1 : 1);
+
+	if (source_get_interval(source1) != source_get_interval(source2))
+		return source_get_interval(source1) -
+			source_get_interval(source2);
+
+	if (source_get_max_interval(source1) !=
+	    source_get_max_interval(source2))
+		return source_get_max_interval(source1) -
+			source_get_max_interval(source2);
+
+	return source_get_address(source1) - source_get_address(source2);
+}
+
+static struct block *block_new(struct source *source)
+{
+	const char *sig = source_get_signature(source);
+	struct block *block;
+
+	block = l_new(struct block, 1);
+	block->table = source_get_table(source);
+	block->address = source_get_address(source);
+	block->size = image_sig_width(sig);
+	block->interval = source_get_interval(source);
+	block->max_interval = source_get_max_interval(source);
+	block->period = block->interval;
+	block->aligned = source_get_phase_aligned(source);
+	block->priority = source_get_priority(source);
+	block->snapshot = source_get_snapshot(source);
+	block->trigger_table = source_get_trigger_table(source);
+	block->trigger = source_get_trigger(source);
+	block->trigger_mask = source_get_trigger_mask(source);
+	block->source_list = l_queue_new();
+	block->peer_list = l_queue_new();
+	block->buffer = NULL;
+
+	l_queue_push_tail(block->source_list, source);
+
+	return block;
+}
+
+static bool block_extend(struct block *block, struct source *source,
+			 uint16_t gap, const struct devlimits *limits)
+{
+	const char *sig = source_get_signature(source);
+	uint32_t first = source_get_address(source);
+	uint32_t last = first + image_sig_width(sig);
+	uint32_t end;
+	uint32_t max;
+
+	if (!block)
+		return false;
+
+	if (block->table != source_get_table(source) ||
+	    block->aligned != source_get_phase_aligned(source) ||
+	    block->priority != source_get_priority(source) ||
+	    snapshot_cmp(block->snapshot, source_get_snapshot(source)) ||
+	    block->trigger_table != source_get_trigger_table(source) ||
+	    block->trigger != source_get_trigger(source) ||
+	    block->trigger_mask != source_get_trigger_mask(source) ||
+	    block->interval != source_get_interval(source) ||
+	    block->max_interval != source_get_max_interval(source))
+		return false;
+
+	end = block->address + block->size;
+	if (first > end + gap)
+		return false;
+
+	/* Learned device limit: up to 2000 bits or 125 registers */
+	max = devlimits_get_max(limits, block->table);
+
+	if (last > end) {
+		if (last - block->address > max)
+			return false;
+
+		/* Don't read across unmapped addresses */
+		if (!devlimits_is_readable(limits, block->table, end, last - 1))
+			return false;
+
+		block->size = last - block->address;
+	}
+
+	l_queue_push_tail(block->source_list, source);
+
+	return true;
+}
+
+static void block_alloc(void *data, void *user_data)
+{
+	struct block *block = data;
+
+	if (MODBUS_TABLE_IS_BITS(block->table))
+		block->buffer = l_new(uint8_t, (block->size + 7) / 8);
+	else
+		block->buffer = l_new(uint16_t, block->size);
+
+	l_info("block(%p): %s addr:(0x%x) size:%d interval:%d %s", block,
+	       source_table_to_string(block->table),
+	       block->address, block->size, block->interval,
+	       source_priority_to_string(block->priority));
+}
+
+/* Worst case interval: adaptive polling backs off up to the maximum */
+static uint16_t source_slowest(const struct source *source)
+{
+	uint16_t interval = source_get_interval(source);
+	uint16_t max_interval = source_get_max_interval(source);
+
+	return (max_interval > interval ? max_interval : interval);
+}
+
+/*
+ * True if 'source' can be decoded from readings of 'cover': its items are
+ * within the range of 'cover', read at least as often and in the same or
+ * higher class. Snapshot and trigger sources have their own schedules.
+ */
+static bool source_covers(const struct source *cover,
+			  const struct source *source)
+{
+	const char *csig = source_get_signature(cover);
+	const char *sig = source_get_signature(source);
+	uint32_t cfirst = source_get_address(cover);
+	uint32_t first = source_get_address(source);
+
+	if (cover == source ||
+	    source_get_table(cover) != source_get_table(source))
+		return false;
+
+	if (first < cfirst ||
+	    first + image_sig_width(sig) > cfirst + image_sig_width(csig))
+		return false;
+
+	if (source_get_snapshot(cover) || source_get_snapshot(source) ||
+	    source_get_trigger(cover) != 0xffff ||
+	    source_get_trigger(source) != 0xffff)
+		return false;
+
+	return (source_slowest(cover) <= source_get_interval(source) &&
+		source_get_priority(cover) <= source_get_priority(source));
+}
+
+/* Widest source covering 'source': never a view itself */
+static struct source *find_cover(struct source **array, unsigned int len,
+				 const struct source *source)
+{
+	struct source *cover = NULL;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		if (!source_covers(array[i], source))
+			continue;
+
+		if (!cover || image_sig_width(source_get_signature(array[i])) >
+			      image_sig_width(source_get_signature(cover)))
+			cover = array[i];
+	}
+
+	return cover;
+}
+
+static bool source_match(const void *a, const void *b)
+{
+	return (a == b);
+}
+
+static bool block_has_source(const void *a, const void *b)
+{
+	const struct block *block = a;
+
+	return (l_queue_find(block->source_list, source_match, b) ?
+		true : false);
+}
+
+/*
+ * Overlapping sources (e.g. a u16 within a u32) are views: appended to
+ * the block reading their cover. Each item is read once per cycle and
+ * all views are decoded from the same response.
+ */
+static void plan_views(struct l_queue *plan, struct source **array,
+		       unsigned int len, struct source **covers)
+{
+	struct block *block;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		if (!covers[i])
+			continue;
+
+		block = l_queue_find(plan, block_has_source, covers[i]);
+		if (!block)
+			continue;
+
+		l_info("source(0x%x): view of 0x%x",
+		       source_get_address(array[i]),
+		       source_get_address(covers[i]));
+		l_queue_push_tail(block->source_list, array[i]);
+	}
+}
+
+/* Source of a planned block: peer candidate */
+struct member {
+	struct source *source;
+	const struct block *block;
+	int table;
+	uint32_t first;
+	uint32_t last;		/* Exclusive */
+};
+
+static int member_cmp(const void *a, const void *b)
+{
+	const struct member *member1 = a;
+	const struct member *member2 = b;
+
+	if (member1->table != member2->table)
+		return member1->table - member2->table;
+
+	return (member1->first > member2->first) -
+		(member1->first < member2->first);
+}
+
+static int block_cmp(const void *a, const void *b)
+{
+	const struct block *block1 = *((const struct block **) a);
+	const struct block *block2 = *((const struct block **) b);
+
+	if (block1->table != block2->table)
+		return block1->table - block2->table;
+
+	return block1->address - block2->address;
+}
+
+/*
+ * Blocks of different classes or intervals may share items: sources of
+ * other blocks overlapping a response are its peers, notified when it
+ * changes the shared items. Blocks and sources are sorted by table and
+ * address and walked in a single merge pass.
+ */
+static void plan_peers(struct l_queue *plan)
+{
+	const struct l_queue_entry *entry;
+	const struct l_queue_entry *sentry;
+	struct member *members;
+	struct member *member;
+	struct block **blocks;
+	struct block *block;
+	unsigned int nblocks = l_queue_length(plan);
+	unsigned int len = 0;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	uint32_t width = 0;
+	uint32_t end;
+
+	if (nblocks < 2)
+		return;
+
+	blocks = l_new(struct block *, nblocks);
+	for (entry = l_queue_get_entries(plan), i = 0;
+	     entry; entry = entry->next, i++) {
+		blocks[i] = entry->data;
+		len += l_queue_length(blocks[i]->source_list);
+	}
+
+	members = l_new(struct member, len);
+	for (i = 0, k = 0; i < nblocks; i++) {
+		for (sentry = l_queue_get_entries(blocks[i]->source_list);
+		     sentry; sentry = sentry->next, k++) {
+			member = &members[k];
+			member->source = sentry->data;
+			member->block = blocks[i];
+			member->table = blocks[i]->table;
+			member->first = source_get_address(member->source);
+			member->last = member->first + image_sig_width(
+				source_get_signature(member->source));
+
+			if (member->last - member->first > width)
+				width = member->last - member->first;
+		}
+	}
+
+	qsort(blocks, nblocks, sizeof(*blocks), block_cmp);
+	qsort(members, len, sizeof(*members), member_cmp);
+
+	for (i = 0, j = 0; i < nblocks; i++) {
+		block = blocks[i];
+		end = block->address + block->size;
+
+		/* Ending before this block: before the next ones too */
+		while (j < len && (members[j].table < block->table ||
+				   (members[j].table == block->table &&
+				    members[j].first + width <= block->address)))
+			j++;
+
+		for (k = j; k < len && members[k].table == block->table &&
+		     members[k].first < end; k++) {
+			member = &members[k];
+			if (member->block != block &&
+			    member->last > block->address)
+				l_queue_push_tail(block->peer_list,
+						  member->source);
+		}
+	}
+
+	l_free(members);
+	l_free(blocks);
+}
+
+struct l_queue *block_plan(struct l_queue *source_list, uint16_t gap,
+			   const struct devlimits *limits)
+{
+	const struct l_queue_entry *entry;
+	struct source **array;
+	struct source **covers;
+	struct source **reads;
+	struct block *block = NULL;
+	struct l_queue *plan;
+	unsigned int len;
+	unsigned int nreads = 0;
+	unsigned int i;
+
+	plan = l_queue_new();
+
+	len = l_queue_length(source_list);
+	if (len == 0)
+		return plan;
+
+	array = l_new(struct source *, len);
+	for (entry = l_queue_get_entries(source_list), i = 0;
+	     entry; entry = entry->next, i++)
+		array[i] = entry->data;
+
+	/* Only sources not covered by others are read */
+	covers = l_new(struct source *, len);
+	reads = l_new(struct source *, len);
+	for (i = 0; i < len; i++) {
+		covers[i] = find_cover(array, len, array[i]);
+		if (!covers[i])
+			reads[nreads++] = array[i];
+	}
+
+	qsort(reads, nreads, sizeof(*reads), source_cmp);
+
+	for (i = 0; i < nreads; i++) {
+		if (block_extend(block, reads[i], gap, limits))
+			continue;
+
+		block = block_new(reads[i]);
+		l_queue_push_tail(plan, block);
+	}
+
+	plan_views(plan, array, len, covers);
+	plan_peers(plan);
+
+	l_free(reads);
+	l_free(covers);
+	l_free(array);
+
+	l_queue_foreach(plan, block_alloc, NULL);
+
+	return plan;
+}
+
+void block_destroy(void *data)
+{
+	struct block *block = data;
+
+	/* Sources are owned by the slave */
+	l_queue_destroy(block->source_list, NULL);
+	l_queue_destroy(block->peer_list, NULL);
+	l_free(block->buffer);
+	l_free(block);
+}
+
+bool block_is_bits(const struct block *block)
+{
+	return MODBUS_TABLE_IS_BITS(block->table);
+}
+
+int block_get_table(const struct block *block)
+{
+	return block->table;
+}
+
+uint16_t block_get_address(const struct block *block)
+{
+	return block->address;
+}
+
+uint16_t block_get_size(const struct block *block)
+{
+	return block->size;
+}
+
+uint16_t block_get_interval(const struct block *block)
+{
+	return block->interval;
+}
+
+uint16_t block_get_max_interval(const struct block *block)
+{
+	return block->max_interval;
+}
+
+uint16_t block_get_period(const struct block *block)
+{
+	return block->period;
+}
+
+bool block_is_phase_aligned(const struct block *block)
+{
+	return block->aligned;
+}
+
+int block_get_priority(const struct block *block)
+{
+	return block->priority;
+}
+
+const char *block_get_snapshot(const struct block *block)
+{
+	return block->snapshot;
+}
+
+int block_get_trigger_table(const struct block *block)
+{
+	return block->trigger_table;
+}
+
+uint16_t block_get_trigger(const struct block *block)
+{
+	return block->trigger;
+}
+
+uint64_t block_get_trigger_mask(const struct block *block)
+{
+	return block->trigger_mask;
+}
+
+void *block_get_buffer(struct block *block)
+{
+	return block->buffer;
+}
+
+const struct l_queue *block_get_source_list(const struct block *block)
+{
+	return block->source_list;
+}
+
+/*
+ * Illegal data address: addresses between sources were merged by the gap
+ * tolerance and are the likely unmapped ones.
+ */
+void block_foreach_gap(const struct block *block, block_gap_func_t func,
+		       void *user_data)
+{
+	const struct l_queue_entry *entry;
+	const struct source *source;
+	uint32_t end = block->address;
+	uint32_t first;
+	uint32_t last;
+
+	/* Sources are sorted by address */
+	for (entry = l_queue_get_entries(block->source_list);
+	     entry; entry = entry->next) {
+		source = entry->data;
+		first = source_get_address(source);
+		last = first + image_sig_width(source_get_signature(source));
+
+		if (first > end)
+			func(block->table, end, first - 1, user_data);
+
+		if (last > end)
+			end = last;
+	}
+}
+
+static bool notify_dirty(const struct l_queue *source_list, int table,
+			 const struct image *image)
+{
+	const struct l_queue_entry *entry;
+	struct source *source;
+	uint16_t address;
+	uint16_t width;
+	bool changed = false;
+
+	for (entry = l_queue_get_entries(source_list);
+	     entry; entry = entry->next) {
+		source = entry->data;
+		address = source_get_address(source);
+		width = image_sig_width(source_get_signature(source));
+
+		if (!image_is_dirty(image, table, address, width))
+			continue;
+
+		source_notify(source);
+		changed = true;
+	}
+
+	return changed;
+}
+
+/*
+ * Merge the response into the image: only sources overlapping changed
+ * items are notified. Return true if any source value has changed.
+ */
+bool block_decode(struct block *block, struct image *image)
+{
+	bool changed;
+
+	/* Unchanged response: no source overlapping dirty items */
+	if (!image_update(image, block->table, block->address, block->size,
+			  block->buffer) &&
+	    !image_is_dirty(image, block->table, block->address, block->size))
+		return false;
+
+	changed = notify_dirty(block->source_list, block->table, image);
+
+	/*
+	 * Peers are notified now: the whole range, gap items included, is
+	 * clean after each reading. Their own block adapts on its changes.
+	 */
+	notify_dirty(block->peer_list, block->table, image);
+	image_clean(image, block->table, block->address, block->size);
+
+	return changed;
+}
+
+/*
+ * Adaptive polling: the period doubles while values are stable, up to
+ * 'max_interval', and snaps back to the polling interval on change.
+ */
+uint16_t block_adapt(struct block *block, bool changed)
+{
+	uint32_t period;
+
+	if (block->max_interval == 0)
+		return block->period;
+
+	if (changed) {
+		block->period = block->interval;
+		return block->period;
+	}
+
+	period = block->period * 2;
+	block->period = (period > block->max_interval ?
+			 block->max_interval : period);
+
+	return block->period;
+}
+
+void block_update_timing(struct block *block, uint32_t jitter, bool overrun)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(block->source_list);
+	     entry; entry = entry->next)
+		source_update_timing(entry->data, jitter, overrun);
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Read plan: sources sharing the same polling interval and register table
+ * are merged into contiguous blocks. Each block is read with a single
+ * modbus transaction and merged into the slave register image, where its
+ * sources are decoded from. Blocks don't exceed the device limits (see
+ * devlimits.h).
+ */
+
+struct block;
+struct devlimits;
+struct image;
+
+/* Unread addresses between sources: 'last' is inclusive */
+typedef void (*block_gap_func_t) (int table, uint16_t first, uint16_t last,
+				  void *user_data);
+
+struct l_queue *block_plan(struct l_queue *source_list, uint16_t gap,
+			   const struct devlimits *limits);
+void block_destroy(void *data);
+
+bool block_is_bits(const struct block *block);
+int block_get_table(const struct block *block);
+uint16_t block_get_address(const struct block *block);
+uint16_t block_get_size(const struct block *block);
+uint16_t block_get_interval(const struct block *block);
+uint16_t block_get_max_interval(const struct block *block);
+uint16_t block_get_period(const struct block *block);
+bool block_is_phase_aligned(const struct block *block);
+int block_get_priority(const struct block *block);
+const char *block_get_snapshot(const struct block *block);
+int block_get_trigger_table(const struct block *block);
+uint16_t block_get_trigger(const struct block *block);
+uint64_t block_get_trigger_mask(const struct block *block);
+void *block_get_buffer(struct block *block);
+const struct l_queue *block_get_source_list(const struct block *block);
+
+bool block_decode(struct block *block, struct image *image);
+uint16_t block_adapt(struct block *block, bool changed);
+void block_update_timing(struct block *block, uint32_t jitter, bool overrun);
+
+void block_foreach_gap(const struct block *block, block_gap_func_t func,
+		       void *user_data);
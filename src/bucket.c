@@ -0,0 +1,200 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <ell/ell.h>
+
+#include "bucket.h"
+
+/* Tokens are kept in millionths: refill is rate * elapsed us */
+#define TOKEN		1000000LL
+#define WINDOW		1000000ULL	/* Rate window: 1 second */
+
+struct bucket {
+	int refs;
+	char *key;			/* Shared buckets only */
+	unsigned int rate;		/* Tokens per second, 0: unlimited */
+	int64_t burst;			/* Capacity: one second of tokens */
+	int64_t tokens;
+	uint64_t last;			/* Last refill (l_time_now) */
+	uint64_t window;		/* Current window start */
+	uint32_t count;			/* Requests at the current window */
+	uint32_t rate_last;		/* Requests at the previous window */
+	uint32_t peak;			/* Highest window count */
+};
+
+static struct l_hashmap *bucket_map;	/* key -> shared bucket */
+
+static void bucket_refill(struct bucket *bucket, uint64_t now)
+{
+	if (now <= bucket->last)
+		return;
+
+	bucket->tokens += (int64_t) (now - bucket->last) * bucket->rate;
+	if (bucket->tokens > bucket->burst)
+		bucket->tokens = bucket->burst;
+
+	bucket->last = now;
+}
+
+static void bucket_count(struct bucket *bucket, uint64_t now)
+{
+	if (now - bucket->window >= WINDOW) {
+		/* Windows without requests count as zero */
+		bucket->rate_last = (now - bucket->window < 2 * WINDOW ?
+				     bucket->count : 0);
+		bucket->window = now - (now - bucket->window) % WINDOW;
+		bucket->count = 0;
+	}
+
+	bucket->count++;
+
+	if (bucket->count > bucket->peak)
+		bucket->peak = bucket->count;
+}
+
+struct bucket *bucket_new(const char *key, unsigned int rate)
+{
+	struct bucket *bucket;
+
+	if (key && bucket_map) {
+		bucket = l_hashmap_lookup(bucket_map, key);
+		if (bucket) {
+			bucket->refs++;
+			return bucket;
+		}
+	}
+
+	bucket = l_new(struct bucket, 1);
+	bucket->refs = 1;
+	bucket->key = l_strdup(key);
+	bucket->rate = rate;
+	/* At least two tokens: room for the reserve */
+	bucket->burst = (rate > 2 ? rate : 2) * TOKEN;
+	bucket->tokens = bucket->burst;
+	bucket->last = l_time_now();
+	bucket->window = bucket->last;
+	bucket->count = 0;
+	bucket->rate_last = 0;
+	bucket->peak = 0;
+
+	if (key) {
+		if (!bucket_map)
+			bucket_map = l_hashmap_string_new();
+
+		l_hashmap_insert(bucket_map, bucket->key, bucket);
+	}
+
+	return bucket;
+}
+
+void bucket_unref(struct bucket *bucket)
+{
+	if (unlikely(!bucket))
+		return;
+
+	if (--bucket->refs)
+		return;
+
+	if (bucket->key)
+		l_hashmap_remove(bucket_map, bucket->key);
+
+	l_free(bucket->key);
+	l_free(bucket);
+}
+
+/*
+ * Take one token from every bucket, or none of them. 'reserve' tokens
+ * must remain available after taking. If not allowed, 'delay' is set to
+ * the time (us) until all buckets are refilled enough.
+ */
+bool bucket_take(struct bucket **buckets, int len, uint64_t now,
+		 unsigned int reserve, uint64_t *delay)
+{
+	struct bucket *bucket;
+	int64_t need = (1 + (int64_t) reserve) * TOKEN;
+	uint64_t wait = 0;
+	uint64_t tmp;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		bucket = buckets[i];
+		if (!bucket || bucket->rate == 0)
+			continue;
+
+		bucket_refill(bucket, now);
+
+		if (bucket->tokens >= need)
+			continue;
+
+		tmp = (need - bucket->tokens + bucket->rate - 1) /
+							bucket->rate;
+		if (tmp > wait)
+			wait = tmp;
+	}
+
+	if (wait) {
+		*delay = wait;
+		return false;
+	}
+
+	for (i = 0; i < len; i++) {
+		bucket = buckets[i];
+		if (!bucket)
+			continue;
+
+		if (bucket->rate)
+			bucket->tokens -= TOKEN;
+
+		bucket_count(bucket, now);
+	}
+
+	return true;
+}
+
+/* Requests taken at the last complete one second window */
+uint32_t bucket_get_rate(const struct bucket *bucket, uint64_t now)
+{
+	if (unlikely(!bucket))
+		return 0;
+
+	if (now - bucket->window >= 2 * WINDOW)
+		return 0;
+
+	if (now - bucket->window >= WINDOW)
+		return bucket->count;
+
+	return bucket->rate_last;
+}
+
+uint32_t bucket_get_peak(const struct bucket *bucket)
+{
+	if (unlikely(!bucket))
+		return 0;
+
+	return bucket->peak;
+}
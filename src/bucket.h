@@ -0,0 +1,36 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Token bucket limiting the request rate (requests per second). Buckets
+ * created with a key are shared: e.g. slaves on the same link or bus.
+ * Requests actually taken are counted per one second window.
+ */
+
+struct bucket;
+
+struct bucket *bucket_new(const char *key, unsigned int rate);
+void bucket_unref(struct bucket *bucket);
+
+bool bucket_take(struct bucket **buckets, int len, uint64_t now,
+		 unsigned int reserve, uint64_t *delay);
+uint32_t bucket_get_rate(const struct bucket *bucket, uint64_t now);
+uint32_t bucket_get_peak(const struct bucket *bucket);
@@ -23,6 +23,7 @@
 #define MANAGER_IFACE			KNOT_MODBUS_SERVICE".Manager1"
 #define SLAVE_IFACE			KNOT_MODBUS_SERVICE".Slave1"
 #define SOURCE_IFACE			KNOT_MODBUS_SERVICE".Source1"
+#define SNAPSHOT_IFACE			KNOT_MODBUS_SERVICE".Snapshot1"
 
 typedef void (*dbus_setup_completed_func_t) (void *user_data);
 
@@ -0,0 +1,283 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <ell/ell.h>
+
+#include <modbus.h>
+
+#include "storage.h"
+#include "driver.h"
+#include "devlimits.h"
+
+struct hole {
+	uint16_t first;
+	uint16_t last;			/* Inclusive */
+	bool confirmed;			/* Persisted: suspected otherwise */
+};
+
+struct space {
+	const char *group;		/* device.conf group */
+	uint16_t pdu_max;		/* Protocol limit */
+	uint16_t max;			/* Learned max quantity */
+	struct l_queue *hole_list;	/* Unreadable or suspected ranges */
+};
+
+struct devlimits {
+	int storage;
+	struct space space[MODBUS_TABLE_MAX];	/* One per register table */
+};
+
+static const char *group_str[] = {
+	[MODBUS_TABLE_COILS] = "Coils",
+	[MODBUS_TABLE_DISCRETE_INPUTS] = "DiscreteInputs",
+	[MODBUS_TABLE_INPUT_REGISTERS] = "InputRegisters",
+	[MODBUS_TABLE_HOLDING_REGISTERS] = "HoldingRegisters",
+};
+
+static struct space *get_space(struct devlimits *limits, int table)
+{
+	return &limits->space[table];
+}
+
+static void space_store(struct devlimits *limits, struct space *space)
+{
+	const struct l_queue_entry *entry;
+	const struct hole *hole;
+	struct l_string *str;
+	const char *sep = "";
+	char *value;
+
+	storage_write_key_int(limits->storage, space->group,
+			      "MaxQuantity", space->max);
+
+	/* Format: "0x0010-0x0013,0x0100-0x01ff" */
+	str = l_string_new(64);
+	for (entry = l_queue_get_entries(space->hole_list);
+	     entry; entry = entry->next) {
+		hole = entry->data;
+		if (!hole->confirmed)
+			continue;
+
+		l_string_append_printf(str, "%s0x%04x-0x%04x", sep,
+				       hole->first, hole->last);
+		sep = ",";
+	}
+
+	value = l_string_unwrap(str);
+	storage_write_key_string(limits->storage, space->group,
+				 "Unreadable", value);
+	l_free(value);
+}
+
+static void space_load(struct devlimits *limits, struct space *space)
+{
+	struct hole *hole;
+	unsigned int first;
+	unsigned int last;
+	char *value;
+	char **ranges;
+	int max = 0;
+	int i;
+
+	space->hole_list = l_queue_new();
+	space->max = space->pdu_max;
+
+	if (storage_read_key_int(limits->storage, space->group,
+				 "MaxQuantity", &max) > 0 &&
+	    max > 0 && max < space->pdu_max)
+		space->max = max;
+
+	value = storage_read_key_string(limits->storage, space->group,
+					"Unreadable");
+	if (!value)
+		return;
+
+	ranges = l_strsplit(value, ',');
+	for (i = 0; ranges && ranges[i]; i++) {
+		if (sscanf(ranges[i], "0x%04x-0x%04x", &first, &last) != 2 ||
+		    first > last || last > 0xffff)
+			continue;
+
+		hole = l_new(struct hole, 1);
+		hole->first = first;
+		hole->last = last;
+		hole->confirmed = true;
+		l_queue_push_tail(space->hole_list, hole);
+	}
+
+	l_strfreev(ranges);
+	l_free(value);
+}
+
+struct devlimits *devlimits_new(const char *filename)
+{
+	struct devlimits *limits;
+	int i;
+
+	limits = l_new(struct devlimits, 1);
+	limits->storage = storage_open(filename);
+
+	for (i = 0; i < MODBUS_TABLE_MAX; i++) {
+		limits->space[i].group = group_str[i];
+		limits->space[i].pdu_max = (MODBUS_TABLE_IS_BITS(i) ?
+					    MODBUS_MAX_READ_BITS :
+					    MODBUS_MAX_READ_REGISTERS);
+		space_load(limits, &limits->space[i]);
+	}
+
+	return limits;
+}
+
+void devlimits_free(struct devlimits *limits)
+{
+	int i;
+
+	if (unlikely(!limits))
+		return;
+
+	for (i = 0; i < MODBUS_TABLE_MAX; i++)
+		l_queue_destroy(limits->space[i].hole_list, l_free);
+
+	storage_close(limits->storage);
+	l_free(limits);
+}
+
+uint16_t devlimits_get_max(const struct devlimits *limits, int table)
+{
+	return limits->space[table].max;
+}
+
+/* True if no unreadable address lies within [first, last] */
+bool devlimits_is_readable(const struct devlimits *limits, int table,
+			   uint16_t first, uint16_t last)
+{
+	const struct space *space = &limits->space[table];
+	const struct l_queue_entry *entry;
+	const struct hole *hole;
+
+	for (entry = l_queue_get_entries(space->hole_list);
+	     entry; entry = entry->next) {
+		hole = entry->data;
+		if (hole->first <= last && first <= hole->last)
+			return false;
+	}
+
+	return true;
+}
+
+/* Return true if the limit has been lowered */
+bool devlimits_shrink(struct devlimits *limits, int table, uint16_t max)
+{
+	struct space *space = get_space(limits, table);
+
+	if (max == 0 || max >= space->max)
+		return false;
+
+	l_info("limits: %s max quantity per read %d -> %d",
+	       space->group, space->max, max);
+
+	space->max = max;
+	space_store(limits, space);
+
+	return true;
+}
+
+/*
+ * Suspected unreadable range: excluded from the read plans, but only
+ * persisted once confirmed. Return true if the range wasn't known yet.
+ */
+bool devlimits_add_hole(struct devlimits *limits, int table,
+			uint16_t first, uint16_t last)
+{
+	struct space *space = get_space(limits, table);
+	struct hole *hole;
+
+	if (first > last || !devlimits_is_readable(limits, table, first, last))
+		return false;
+
+	l_info("limits: %s 0x%04x-0x%04x suspected unreadable",
+	       space->group, first, last);
+
+	hole = l_new(struct hole, 1);
+	hole->first = first;
+	hole->last = last;
+	hole->confirmed = false;
+	l_queue_push_tail(space->hole_list, hole);
+
+	return true;
+}
+
+static bool hole_match(const void *a, const void *b)
+{
+	const struct hole *hole = a;
+	const struct hole *range = b;
+
+	return (hole->first == range->first && hole->last == range->last);
+}
+
+/* A reading of the range itself failed: persisted from now on */
+void devlimits_confirm_hole(struct devlimits *limits, int table,
+			    uint16_t first, uint16_t last)
+{
+	struct space *space = get_space(limits, table);
+	struct hole range;
+	struct hole *hole;
+
+	range.first = first;
+	range.last = last;
+	hole = l_queue_find(space->hole_list, hole_match, &range);
+	if (!hole || hole->confirmed)
+		return;
+
+	l_info("limits: %s 0x%04x-0x%04x unreadable",
+	       space->group, first, last);
+
+	hole->confirmed = true;
+	space_store(limits, space);
+}
+
+/* Not confirmed: read plans may span the range again */
+void devlimits_remove_hole(struct devlimits *limits, int table,
+			   uint16_t first, uint16_t last)
+{
+	struct space *space = get_space(limits, table);
+	struct hole range;
+	struct hole *hole;
+
+	range.first = first;
+	range.last = last;
+	hole = l_queue_find(space->hole_list, hole_match, &range);
+	if (!hole || hole->confirmed)
+		return;
+
+	l_info("limits: %s 0x%04x-0x%04x readable",
+	       space->group, first, last);
+
+	l_queue_remove(space->hole_list, hole);
+	l_free(hole);
+}
@@ -0,0 +1,45 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Device limits learned online: maximum quantity per read request and
+ * unreadable (unmapped) address ranges, per register table. Read
+ * plans don't exceed the quantity nor span unreadable ranges. Limits are
+ * persisted at the slave directory (device.conf). Unreadable ranges are
+ * suspected first, and persisted once confirmed by a reading of their own.
+ */
+
+struct devlimits;
+
+struct devlimits *devlimits_new(const char *filename);
+void devlimits_free(struct devlimits *limits);
+
+uint16_t devlimits_get_max(const struct devlimits *limits, int table);
+bool devlimits_is_readable(const struct devlimits *limits, int table,
+			   uint16_t first, uint16_t last);
+
+bool devlimits_shrink(struct devlimits *limits, int table, uint16_t max);
+bool devlimits_add_hole(struct devlimits *limits, int table,
+			uint16_t first, uint16_t last);
+void devlimits_confirm_hole(struct devlimits *limits, int table,
+			    uint16_t first, uint16_t last);
+void devlimits_remove_hole(struct devlimits *limits, int table,
+			   uint16_t first, uint16_t last);
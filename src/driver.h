@@ -19,14 +19,73 @@
  *
  */
 
+/*
+ * Asynchronous modbus master. Callbacks run on the main loop and receive
+ * zero or a negative errno: -ETIMEDOUT (no response), -EFAULT (illegal
+ * data address exception), -EINVAL (illegal data value exception),
+ * -ECONNRESET (disconnected) or -EIO (other failures). 'destroy' is
+ * called once the request is completed or cancelled. Destination
+ * buffers must remain valid until then.
+ */
+
+/* Requests of higher classes (lower values) are served first */
+enum modbus_priority {
+	MODBUS_PRIORITY_CRITICAL,
+	MODBUS_PRIORITY_NORMAL,
+	MODBUS_PRIORITY_BACKGROUND,
+	MODBUS_PRIORITY_MAX,
+};
+
+/* Data model: each table is an address space of its own */
+enum modbus_table {
+	MODBUS_TABLE_COILS,		/* FC1: read-write bits */
+	MODBUS_TABLE_DISCRETE_INPUTS,	/* FC2: read-only bits */
+	MODBUS_TABLE_INPUT_REGISTERS,	/* FC4: read-only registers */
+	MODBUS_TABLE_HOLDING_REGISTERS,	/* FC3: read-write registers */
+	MODBUS_TABLE_MAX,
+};
+
+#define MODBUS_TABLE_IS_BITS(table)	((table) <= MODBUS_TABLE_DISCRETE_INPUTS)
+
+typedef void (*modbus_driver_func_t) (int err, void *user_data);
+typedef void (*modbus_driver_destroy_func_t) (void *user_data);
+
 struct modbus_driver {
 	const char *name; /* tcp or rtu */
-	modbus_t *(*create) (const char *url); /* url includes path and settings */
-	void (*destroy) (modbus_t *ctx);
-
-	int (*read_bool) (modbus_t *ctx, uint16_t addr, bool *out);
-	int (*read_byte) (modbus_t *ctx, uint16_t addr, uint8_t *out);
-	int (*read_u16) (modbus_t *ctx, uint16_t addr, uint16_t *out);
-	int (*read_u32) (modbus_t *ctx, uint16_t addr, uint32_t *out);
-	int (*read_u64) (modbus_t *ctx, uint16_t addr, uint64_t *out);
+	/* url includes path and settings */
+	void *(*create) (const char *url, uint8_t id,
+			 modbus_driver_func_t disconnected_cb,
+			 void *user_data);
+	void (*destroy) (void *ctx);
+
+	int (*connect) (void *ctx, modbus_driver_func_t func,
+			void *user_data);
+
+	/*
+	 * Block reads: bits (coils or discrete inputs) packed LSB first,
+	 * (nb + 7) / 8 bytes, or one u16 per register (input or holding
+	 * registers)
+	 */
+	unsigned int (*read_bits) (void *ctx, enum modbus_table table,
+				   uint16_t addr, uint16_t nb,
+				   enum modbus_priority prio, uint8_t *out,
+				   modbus_driver_func_t func,
+				   void *user_data,
+				   modbus_driver_destroy_func_t destroy);
+	unsigned int (*read_registers) (void *ctx, enum modbus_table table,
+					uint16_t addr, uint16_t nb,
+					enum modbus_priority prio,
+					uint16_t *out,
+					modbus_driver_func_t func,
+					void *user_data,
+					modbus_driver_destroy_func_t destroy);
+	void (*cancel) (void *ctx, unsigned int id);
+
+	/* Queueing delay moving average (us) of the link or bus */
+	uint32_t (*queue_delay) (void *ctx, enum modbus_priority prio);
+
+	/* Per slave response timeout (ms): zero derives it from the RTT */
+	void (*set_timeout) (void *ctx, uint32_t ms);
+	uint32_t (*get_timeout) (void *ctx);
+	uint32_t (*get_rtt) (void *ctx);	/* Smoothed RTT (us) */
 };
@@ -0,0 +1,434 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <ell/ell.h>
+
+#include "driver.h"
+#include "image.h"
+
+struct space {
+	uint16_t base;		/* First bit or register */
+	uint32_t count;		/* Number of bits or registers */
+	void *data;		/* Packed bits (u64 words) or u16 per register */
+	uint64_t *dirty;	/* One bit per item changed */
+};
+
+struct image {
+	struct space space[MODBUS_TABLE_MAX];	/* One per register table */
+};
+
+#define DIRTY_WORDS(count)	(((count) + 63) / 64)
+
+static struct space *get_space(struct image *image, int table)
+{
+	return &image->space[table];
+}
+
+static const struct space *get_const_space(const struct image *image,
+					   int table)
+{
+	return &image->space[table];
+}
+
+/* Clamp [addr, addr + nb) to the space: false if outside */
+static bool space_range(const struct space *space, uint32_t addr,
+			uint32_t nb, uint32_t *first, uint32_t *last)
+{
+	uint32_t end = addr + nb;
+
+	if (addr < space->base)
+		addr = space->base;
+
+	if (end > space->base + space->count)
+		end = space->base + space->count;
+
+	if (addr >= end)
+		return false;
+
+	*first = addr - space->base;
+	*last = end - space->base;
+
+	return true;
+}
+
+/* Up to 64 bits at bit 'pos' of a bitset of u64 words, LSB first */
+static uint64_t bits_get(const uint64_t *words, uint32_t pos, unsigned int n)
+{
+	unsigned int shift = pos % 64;
+	uint64_t value = words[pos / 64] >> shift;
+
+	if (shift && shift + n > 64)
+		value |= words[pos / 64 + 1] << (64 - shift);
+
+	return (n == 64 ? value : value & (((uint64_t) 1 << n) - 1));
+}
+
+static void bits_put(uint64_t *words, uint32_t pos, unsigned int n,
+		     uint64_t value)
+{
+	unsigned int shift = pos % 64;
+	uint64_t mask = (n == 64 ? UINT64_MAX : ((uint64_t) 1 << n) - 1);
+
+	value &= mask;
+	words[pos / 64] = (words[pos / 64] & ~(mask << shift)) |
+			  (value << shift);
+
+	if (shift && shift + n > 64)
+		words[pos / 64 + 1] = (words[pos / 64 + 1] &
+				       ~(mask >> (64 - shift))) |
+				      (value >> (64 - shift));
+}
+
+/* Up to 64 bits at bit 'pos' of a response: bytes, LSB first */
+static uint64_t packed_get(const uint8_t *bytes, uint32_t pos, unsigned int n)
+{
+	const uint8_t *p = bytes + pos / 8;
+	unsigned int shift = pos % 8;
+	unsigned int len = (shift + n + 7) / 8;
+	uint64_t value = 0;
+	unsigned int i;
+
+	for (i = 0; i < len && i < 8; i++)
+		value |= (uint64_t) p[i] << (8 * i);
+
+	value >>= shift;
+	if (len > 8)
+		value |= (uint64_t) p[8] << (64 - shift);
+
+	return (n == 64 ? value : value & (((uint64_t) 1 << n) - 1));
+}
+
+static void space_free(struct space *space)
+{
+	l_free(space->data);
+	l_free(space->dirty);
+}
+
+struct image *image_new(void)
+{
+	return l_new(struct image, 1);
+}
+
+void image_free(struct image *image)
+{
+	int i;
+
+	if (unlikely(!image))
+		return;
+
+	for (i = 0; i < MODBUS_TABLE_MAX; i++)
+		space_free(&image->space[i]);
+
+	l_free(image);
+}
+
+void image_resize(struct image *image, int table,
+		  uint16_t base, uint32_t count)
+{
+	struct space *space = get_space(image, table);
+	bool bits = MODBUS_TABLE_IS_BITS(table);
+	uint32_t first;
+	uint32_t last;
+	uint32_t i;
+	unsigned int n;
+	void *data = NULL;
+
+	if (space->base == base && space->count == count)
+		return;
+
+	if (count && bits)
+		data = l_new(uint64_t, DIRTY_WORDS(count));
+	else if (count)
+		data = l_new(uint16_t, count);
+
+	/* Overlapping values: sources keep their last readings */
+	if (data && space_range(space, base, count, &first, &last)) {
+		if (bits) {
+			for (i = first; i < last; i += n) {
+				n = (last - i > 64 ? 64 : last - i);
+				bits_put(data, i + space->base - base, n,
+					 bits_get(space->data, i, n));
+			}
+		} else {
+			memcpy((uint16_t *) data + first + space->base - base,
+			       (uint16_t *) space->data + first,
+			       (last - first) * sizeof(uint16_t));
+		}
+	}
+
+	space_free(space);
+	space->base = base;
+	space->count = count;
+	space->data = data;
+	space->dirty = (count ? l_new(uint64_t, DIRTY_WORDS(count)) : NULL);
+}
+
+/* Change detection reference: mask of the registers that differ */
+uint64_t image_diff_registers_scalar(const uint16_t *old,
+				     const uint16_t *new, unsigned int n)
+{
+	uint64_t mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		if (old[i] != new[i])
+			mask |= (uint64_t) 1 << i;
+
+	return mask;
+}
+
+/*
+ * Vectorized when the target supports it, the scalar loop handles the
+ * remaining registers. Bits are compared with a word-wide XOR: packed,
+ * 64 per word.
+ */
+uint64_t image_diff_registers(const uint16_t *old, const uint16_t *new,
+			      unsigned int n)
+{
+	uint64_t mask = 0;
+	unsigned int i = 0;
+
+#if defined(__AVX2__)
+	__m256i eq0;
+	__m256i eq1;
+	__m256i eq;
+#endif
+#if defined(__SSE2__)
+	__m128i eq8;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint8_t weight[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x8_t vw = vld1_u8(weight);
+	uint8x8_t ne;
+#endif
+
+#if defined(__AVX2__)
+	/* Packed to one byte per register: lanes reordered by the permute */
+	for (; i + 32 <= n; i += 32) {
+		eq0 = _mm256_cmpeq_epi16(
+			_mm256_loadu_si256((const __m256i *) (old + i)),
+			_mm256_loadu_si256((const __m256i *) (new + i)));
+		eq1 = _mm256_cmpeq_epi16(
+			_mm256_loadu_si256((const __m256i *) (old + i + 16)),
+			_mm256_loadu_si256((const __m256i *) (new + i + 16)));
+		eq = _mm256_permute4x64_epi64(_mm256_packs_epi16(eq0, eq1),
+					      0xd8);
+		mask |= (uint64_t) (uint32_t) ~_mm256_movemask_epi8(eq) << i;
+	}
+#endif
+
+#if defined(__SSE2__)
+	/* AVX2 too: remaining blocks of 8 */
+	for (; i + 8 <= n; i += 8) {
+		eq8 = _mm_cmpeq_epi16(
+			_mm_loadu_si128((const __m128i *) (old + i)),
+			_mm_loadu_si128((const __m128i *) (new + i)));
+		eq8 = _mm_packs_epi16(eq8, _mm_setzero_si128());
+		mask |= (uint64_t) (~_mm_movemask_epi8(eq8) & 0xff) << i;
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for (; i + 8 <= n; i += 8) {
+		ne = vmvn_u8(vmovn_u16(vceqq_u16(vld1q_u16(old + i),
+						 vld1q_u16(new + i))));
+		mask |= (uint64_t) vaddv_u8(vand_u8(ne, vw)) << i;
+	}
+#endif
+
+	if (i < n)
+		mask |= image_diff_registers_scalar(old + i, new + i,
+						    n - i) << i;
+
+	return mask;
+}
+
+/* OR 'mask' into the bitmap starting at bit 'first' */
+static void dirty_set(uint64_t *dirty, uint32_t first, uint64_t mask)
+{
+	unsigned int shift = first % 64;
+
+	dirty[first / 64] |= mask << shift;
+	if (shift && (mask >> (64 - shift)))
+		dirty[first / 64 + 1] |= mask >> (64 - shift);
+}
+
+/* Mask of the bits [first, last) within the bitmap word 'word' */
+static uint64_t word_mask(uint32_t word, uint32_t first, uint32_t last)
+{
+	uint32_t lo = (first > word * 64 ? first - word * 64 : 0);
+	uint32_t hi = (last < (word + 1) * 64 ? last - word * 64 : 64);
+	uint64_t mask = (hi == 64 ? UINT64_MAX :
+			 ((uint64_t) 1 << hi) - 1);
+
+	return mask & ~(((uint64_t) 1 << lo) - 1);
+}
+
+bool image_update(struct image *image, int table, uint16_t addr,
+		  uint16_t nb, const void *data)
+{
+	struct space *space = get_space(image, table);
+	bool bits = MODBUS_TABLE_IS_BITS(table);
+	const uint16_t *src16 = data;
+	uint16_t *dst16 = space->data;
+	uint64_t value;
+	uint64_t mask;
+	uint32_t offset;
+	uint32_t first;
+	uint32_t last;
+	uint32_t i;
+	unsigned int n;
+	bool changed = false;
+
+	if (!space_range(space, addr, nb, &first, &last))
+		return false;
+
+	offset = first + space->base - addr;
+
+	for (i = first; i < last; i += n) {
+		n = (last - i > 64 ? 64 : last - i);
+
+		if (bits) {
+			value = packed_get(data, offset + i - first, n);
+			mask = value ^ bits_get(space->data, i, n);
+			if (mask)
+				bits_put(space->data, i, n, value);
+		} else {
+			mask = image_diff_registers(dst16 + i,
+					      src16 + offset + i - first, n);
+		}
+
+		if (!mask)
+			continue;
+
+		dirty_set(space->dirty, i, mask);
+		changed = true;
+	}
+
+	if (changed && !bits)
+		memcpy(dst16 + first, src16 + offset,
+		       (last - first) * sizeof(uint16_t));
+
+	return changed;
+}
+
+bool image_is_dirty(const struct image *image, int table,
+		    uint16_t addr, uint16_t nb)
+{
+	const struct space *space = get_const_space(image, table);
+	uint32_t first;
+	uint32_t last;
+	uint32_t w;
+
+	if (!space_range(space, addr, nb, &first, &last))
+		return false;
+
+	for (w = first / 64; w <= (last - 1) / 64; w++)
+		if (space->dirty[w] & word_mask(w, first, last))
+			return true;
+
+	return false;
+}
+
+void image_clean(struct image *image, int table, uint16_t addr, uint16_t nb)
+{
+	struct space *space = get_space(image, table);
+	uint32_t first;
+	uint32_t last;
+	uint32_t w;
+
+	if (!space_range(space, addr, nb, &first, &last))
+		return;
+
+	for (w = first / 64; w <= (last - 1) / 64; w++)
+		space->dirty[w] &= ~word_mask(w, first, last);
+}
+
+bool image_sig_is_bits(const char *sig)
+{
+	return (sig[0] == 'b' || sig[0] == 'y');
+}
+
+/* Amount of bits or registers required to represent a given type */
+uint16_t image_sig_width(const char *sig)
+{
+	switch (sig[0]) {
+	case 'b':
+		return 1;
+	case 'y':
+		return 8;
+	case 'q':
+		return 1;
+	case 'u':
+		return 2;
+	case 't':
+		return 4;
+	default:
+		return 1;
+	}
+}
+
+uint64_t image_get_value(const struct image *image, int table,
+			 const char *sig, uint16_t addr)
+{
+	const struct space *space = get_const_space(image, table);
+	const uint16_t *regs = space->data;
+	uint32_t offset;
+	uint32_t last;
+	uint32_t val_u32;
+	uint64_t val_u64;
+
+	/* Not read yet */
+	if (!space_range(space, addr, image_sig_width(sig), &offset, &last) ||
+	    last - offset < image_sig_width(sig))
+		return 0;
+
+	switch (sig[0]) {
+	case 'b':
+		return bits_get(space->data, offset, 1);
+	case 'y':
+		/* LSB is the first address */
+		return bits_get(space->data, offset, 8);
+	case 'q':
+		return regs[offset];
+	case 'u':
+		/* Assuming network order */
+		memcpy(&val_u32, &regs[offset], sizeof(val_u32));
+		return L_BE32_TO_CPU(val_u32);
+	case 't':
+		/* Assuming network order */
+		memcpy(&val_u64, &regs[offset], sizeof(val_u64));
+		return L_BE64_TO_CPU(val_u64);
+	default:
+		return 0;
+	}
+}
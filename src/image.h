@@ -0,0 +1,56 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Register image: shadow copy of the slave address space being polled,
+ * one area per register table (modbus_table). Block responses are merged
+ * into the image and a dirty bitmap flags the items changed since the
+ * last decoding. Sources are typed views (address and signature) into
+ * the image: values are stored once per slave.
+ */
+
+struct image;
+
+struct image *image_new(void);
+void image_free(struct image *image);
+
+/* Covered range: contents of the previous range are kept */
+void image_resize(struct image *image, int table,
+		  uint16_t base, uint32_t count);
+
+/* Return true if any item has changed: flagged as dirty */
+bool image_update(struct image *image, int table, uint16_t addr,
+		  uint16_t nb, const void *data);
+bool image_is_dirty(const struct image *image, int table,
+		    uint16_t addr, uint16_t nb);
+void image_clean(struct image *image, int table, uint16_t addr, uint16_t nb);
+
+/* Typed view: raw value widened to 64 bits */
+uint64_t image_get_value(const struct image *image, int table,
+			 const char *sig, uint16_t addr);
+uint16_t image_sig_width(const char *sig);
+bool image_sig_is_bits(const char *sig);
+
+/* Change detection kernels: mask of the registers that differ, n <= 64 */
+uint64_t image_diff_registers(const uint16_t *old, const uint16_t *new,
+			      unsigned int n);
+uint64_t image_diff_registers_scalar(const uint16_t *old,
+				     const uint16_t *new, unsigned int n);
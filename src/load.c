@@ -0,0 +1,198 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <ell/ell.h>
+
+#include "driver.h"
+#include "load.h"
+
+#define LOAD_WINDOW		5000000ULL	/* Evaluation window: 5 s */
+#define LOAD_THRESHOLD		10		/* Overrun percentage */
+#define LOAD_FACTOR_MAX		8		/* Maximum stretch */
+
+struct watch {
+	load_func_t func;
+	void *user_data;
+};
+
+struct load {
+	int refs;
+	char *key;
+	uint64_t window;		/* Current window start */
+	unsigned int samples;		/* Deadlines at the window */
+	unsigned int overruns;		/* Overruns at the window */
+	unsigned int factor[MODBUS_PRIORITY_MAX];	/* Interval stretch */
+	struct l_queue *watch_list;	/* Notified on factor change */
+};
+
+static struct l_hashmap *load_map;	/* key -> load */
+
+static bool watch_cmp(const void *a, const void *b)
+{
+	const struct watch *watch = a;
+
+	return (watch->user_data == b ? true : false);
+}
+
+static void watch_notify(void *data, void *user_data)
+{
+	struct watch *watch = data;
+
+	watch->func(watch->user_data);
+}
+
+struct load *load_get(const char *key, load_func_t changed,
+		      void *user_data)
+{
+	struct load *load = NULL;
+	struct watch *watch;
+	int prio;
+
+	if (load_map)
+		load = l_hashmap_lookup(load_map, key);
+
+	if (!load) {
+		load = l_new(struct load, 1);
+		load->refs = 0;
+		load->key = l_strdup(key);
+		load->window = l_time_now();
+		load->samples = 0;
+		load->overruns = 0;
+		load->watch_list = l_queue_new();
+
+		for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++)
+			load->factor[prio] = 1;
+
+		if (!load_map)
+			load_map = l_hashmap_string_new();
+
+		l_hashmap_insert(load_map, load->key, load);
+	}
+
+	watch = l_new(struct watch, 1);
+	watch->func = changed;
+	watch->user_data = user_data;
+	l_queue_push_tail(load->watch_list, watch);
+
+	load->refs++;
+
+	return load;
+}
+
+void load_put(struct load *load, void *user_data)
+{
+	if (unlikely(!load))
+		return;
+
+	l_free(l_queue_remove_if(load->watch_list, watch_cmp, user_data));
+
+	if (--load->refs)
+		return;
+
+	l_hashmap_remove(load_map, load->key);
+	l_queue_destroy(load->watch_list, l_free);
+	l_free(load->key);
+	l_free(load);
+}
+
+/* Stretch the lowest class not stretched to the maximum yet */
+static bool load_shed(struct load *load)
+{
+	int prio;
+
+	for (prio = MODBUS_PRIORITY_MAX - 1;
+	     prio > MODBUS_PRIORITY_CRITICAL; prio--) {
+		if (load->factor[prio] >= LOAD_FACTOR_MAX)
+			continue;
+
+		load->factor[prio] *= 2;
+
+		l_info("load(%s): overloaded, class %d interval x%d",
+		       load->key, prio, load->factor[prio]);
+
+		return true;
+	}
+
+	return false;
+}
+
+/* Restore the highest stretched class first */
+static bool load_restore(struct load *load)
+{
+	int prio;
+
+	for (prio = MODBUS_PRIORITY_CRITICAL + 1;
+	     prio < MODBUS_PRIORITY_MAX; prio++) {
+		if (load->factor[prio] == 1)
+			continue;
+
+		load->factor[prio] /= 2;
+
+		l_info("load(%s): headroom, class %d interval x%d",
+		       load->key, prio, load->factor[prio]);
+
+		return true;
+	}
+
+	return false;
+}
+
+void load_sample(struct load *load, uint64_t now, bool overrun)
+{
+	bool changed;
+
+	load->samples++;
+	if (overrun)
+		load->overruns++;
+
+	if (now - load->window < LOAD_WINDOW)
+		return;
+
+	/* One step per window: sustained overrun only */
+	if (load->overruns * 100 > load->samples * LOAD_THRESHOLD)
+		changed = load_shed(load);
+	else if (load->overruns == 0)
+		changed = load_restore(load);
+	else
+		changed = false;
+
+	load->window = now;
+	load->samples = 0;
+	load->overruns = 0;
+
+	if (changed)
+		l_queue_foreach(load->watch_list, watch_notify, NULL);
+}
+
+unsigned int load_get_factor(const struct load *load, int prio)
+{
+	if (unlikely(!load) || prio < 0 || prio >= MODBUS_PRIORITY_MAX)
+		return 1;
+
+	return load->factor[prio];
+}
@@ -0,0 +1,39 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Load shedding per link (TCP connection or serial bus). Polling
+ * deadlines reached while the previous reading is still in progress
+ * (overruns) are sampled per window. Sustained overrun stretches the
+ * intervals of the lowest priority classes first; clean windows
+ * restore them in reverse order. Critical sources are never stretched.
+ */
+
+typedef void (*load_func_t) (void *user_data);
+
+struct load;
+
+struct load *load_get(const char *key, load_func_t changed,
+		      void *user_data);
+void load_put(struct load *load, void *user_data);
+
+void load_sample(struct load *load, uint64_t now, bool overrun);
+unsigned int load_get_factor(const struct load *load, int prio);
@@ -25,16 +25,19 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <ell/ell.h>
 
 #include "dbus.h"
 #include "options.h"
 #include "slave.h"
 #include "storage.h"
+#include "ramp.h"
 #include "manager.h"
 
 struct main_options main_opts;
 struct serial_options serial_opts;
+struct tcp_options tcp_opts;
 
 static struct l_queue *slave_list;
 
@@ -56,18 +59,35 @@ static bool path_cmp(const void *a, const void *b)
 
 static int options_load(const char *filename)
 {
+	char *overrun;
 	char *parity;
 	int strg;
 
 	/* TODO: missing D-Bus settings */
 	main_opts.tcp = false;
 	main_opts.polling_interval = 1000; /* 1000ms */
+	main_opts.block_gap = 0; /* Contiguous addresses only */
+	main_opts.workers = 64;
+	main_opts.overrun = OVERRUN_SKIP;
+	main_opts.slave_rate = 0; /* Unlimited */
+	main_opts.link_rate = 0;
+	main_opts.global_rate = 0;
+	main_opts.retry_min = 1; /* 1s doubling up to 5 minutes */
+	main_opts.retry_max = 300;
+	main_opts.breaker_timeouts = 5;
+	main_opts.connect_max = 16;
+	main_opts.connect_rate = 20;
+	main_opts.timeout_initial = 500; /* ms: libmodbus default */
+	main_opts.timeout_min = 10;
+	main_opts.timeout_max = 5000;
 
 	serial_opts.baud = 115200;
 	serial_opts.parity = 'N';
 	serial_opts.data_bit = 8;
 	serial_opts.stop_bit = 1;
 
+	tcp_opts.transactions = 1;
+
 	if (!filename)
 		return 0;
 
@@ -79,12 +99,82 @@ static int options_load(const char *filename)
 	storage_read_key_int(strg, "Serial", "DataBit", &serial_opts.data_bit);
 	storage_read_key_int(strg, "Serial", "StopBit", &serial_opts.stop_bit);
 
+	storage_read_key_int(strg, "General", "Workers", &main_opts.workers);
+
+	storage_read_key_int(strg, "Polling", "BlockGap", &main_opts.block_gap);
+	if (main_opts.block_gap < 0)
+		main_opts.block_gap = 0;
+
+	storage_read_key_int(strg, "Polling", "SlaveRate",
+			     &main_opts.slave_rate);
+	storage_read_key_int(strg, "Polling", "LinkRate",
+			     &main_opts.link_rate);
+	storage_read_key_int(strg, "Polling", "GlobalRate",
+			     &main_opts.global_rate);
+
+	if (main_opts.slave_rate < 0)
+		main_opts.slave_rate = 0;
+	if (main_opts.link_rate < 0)
+		main_opts.link_rate = 0;
+	if (main_opts.global_rate < 0)
+		main_opts.global_rate = 0;
+
+	storage_read_key_int(strg, "Reconnect", "MinInterval",
+			     &main_opts.retry_min);
+	storage_read_key_int(strg, "Reconnect", "MaxInterval",
+			     &main_opts.retry_max);
+	storage_read_key_int(strg, "Reconnect", "BreakerTimeouts",
+			     &main_opts.breaker_timeouts);
+
+	storage_read_key_int(strg, "Reconnect", "MaxConnecting",
+			     &main_opts.connect_max);
+	storage_read_key_int(strg, "Reconnect", "ConnectRate",
+			     &main_opts.connect_rate);
+
+	if (main_opts.retry_min < 1)
+		main_opts.retry_min = 1;
+	if (main_opts.retry_max < main_opts.retry_min)
+		main_opts.retry_max = main_opts.retry_min;
+	if (main_opts.breaker_timeouts < 0)
+		main_opts.breaker_timeouts = 0;
+	if (main_opts.connect_max < 0)
+		main_opts.connect_max = 0;
+	if (main_opts.connect_rate < 0)
+		main_opts.connect_rate = 0;
+
+	storage_read_key_int(strg, "Timeout", "InitialResponseTimeout",
+			     &main_opts.timeout_initial);
+	storage_read_key_int(strg, "Timeout", "MinResponseTimeout",
+			     &main_opts.timeout_min);
+	storage_read_key_int(strg, "Timeout", "MaxResponseTimeout",
+			     &main_opts.timeout_max);
+
+	if (main_opts.timeout_min < 1)
+		main_opts.timeout_min = 1;
+	if (main_opts.timeout_max < main_opts.timeout_min)
+		main_opts.timeout_max = main_opts.timeout_min;
+
+	overrun = storage_read_key_string(strg, "Polling", "Overrun");
+	if (overrun) {
+		if (strcmp(overrun, "catchup") == 0)
+			main_opts.overrun = OVERRUN_CATCHUP;
+		else if (strcmp(overrun, "stretch") == 0)
+			main_opts.overrun = OVERRUN_STRETCH;
+		else if (strcmp(overrun, "skip") != 0)
+			l_error("Polling: invalid overrun policy '%s'",
+				overrun);
+		l_free(overrun);
+	}
+
 	parity = storage_read_key_string(strg, "Serial", "Parity");
 	if (parity) {
 		serial_opts.parity = parity[0];
 		l_free(parity);
 	}
 
+	storage_read_key_int(strg, "TCP", "MaxTransactions",
+			     &tcp_opts.transactions);
+
 	storage_close(strg);
 
 	return 0;
@@ -184,6 +274,45 @@ static struct l_dbus_message *method_slave_remove(struct l_dbus *dbus,
 	return l_dbus_message_new_method_return(msg);
 }
 
+static bool property_get_ramp_duration(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct ramp_stats stats;
+
+	ramp_get_stats(&stats);
+	l_dbus_message_builder_append_basic(builder, 'u', &stats.duration);
+
+	return true;
+}
+
+static bool property_get_ramp_cpu_time(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct ramp_stats stats;
+
+	ramp_get_stats(&stats);
+	l_dbus_message_builder_append_basic(builder, 'u', &stats.cpu_time);
+
+	return true;
+}
+
+static bool property_get_ramp_peak_cpu(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct ramp_stats stats;
+
+	ramp_get_stats(&stats);
+	l_dbus_message_builder_append_basic(builder, 'u', &stats.peak_cpu);
+
+	return true;
+}
+
 static void setup_interface(struct l_dbus_interface *interface)
 {
 	/* Add/Remove slaves (a.k.a variables)  */
@@ -193,6 +322,22 @@ static void setup_interface(struct l_dbus_interface *interface)
 
 	l_dbus_interface_method(interface, "RemoveSlave", 0,
 				method_slave_remove, "", "o", "path");
+
+	/* Last connection ramp-up: until every slave settled */
+	if (!l_dbus_interface_property(interface, "RampDuration", 0, "u",
+				       property_get_ramp_duration,
+				       NULL))
+		l_error("Can't add 'RampDuration' property");
+
+	if (!l_dbus_interface_property(interface, "RampCpuTime", 0, "u",
+				       property_get_ramp_cpu_time,
+				       NULL))
+		l_error("Can't add 'RampCpuTime' property");
+
+	if (!l_dbus_interface_property(interface, "RampPeakCpu", 0, "u",
+				       property_get_ramp_peak_cpu,
+				       NULL))
+		l_error("Can't add 'RampPeakCpu' property");
 }
 
 static void ready_cb(void *user_data)
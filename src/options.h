@@ -19,9 +19,30 @@
  *
  */
 
+/* Polling deadline reached while the previous reading is in progress */
+enum overrun_policy {
+	OVERRUN_SKIP,		/* Drop the missed readings */
+	OVERRUN_CATCHUP,	/* Read back-to-back until back on schedule */
+	OVERRUN_STRETCH,	/* Restart the schedule after the late reading */
+};
+
 struct main_options {
 	bool		tcp;			/* D-Bus TCP - default false */
 	uint16_t	polling_interval;	/* Source reading interval */
+	int		block_gap;		/* Unused addresses to merge */
+	int		workers;		/* Max blocking I/O threads */
+	enum overrun_policy overrun;		/* Late polling policy */
+	int		slave_rate;		/* Requests/s per slave */
+	int		link_rate;		/* Requests/s per link or bus */
+	int		global_rate;		/* Requests/s daemon-wide */
+	int		retry_min;		/* Reconnect backoff: seconds */
+	int		retry_max;		/* Reconnect backoff cap */
+	int		breaker_timeouts;	/* Timeouts opening the breaker */
+	int		connect_max;		/* Connection attempts in flight */
+	int		connect_rate;		/* Connection attempts per second */
+	int		timeout_initial;	/* Response timeout: first guess */
+	int		timeout_min;		/* Response timeout bounds in ms */
+	int		timeout_max;
 };
 
 /*
@@ -36,5 +57,10 @@ struct serial_options {
 	int		stop_bit; /* 1 or 2 */
 };
 
+struct tcp_options {
+	int		transactions; /* Max in flight per connection */
+};
+
 extern struct main_options main_opts;
 extern struct serial_options serial_opts;
+extern struct tcp_options tcp_opts;
@@ -0,0 +1,254 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <ell/ell.h>
+
+#include "dbus.h"
+#include "driver.h"
+#include "ramp.h"
+
+struct ramp_req {
+	int prio;
+	bool admitted;
+	ramp_func_t func;
+	void *user_data;
+};
+
+static struct l_queue *wait_list[MODBUS_PRIORITY_MAX];
+static unsigned int waiting;
+static unsigned int active;
+static int max_active;
+static uint64_t pace;			/* us between admissions */
+static uint64_t last_admit;		/* l_time_now */
+static struct l_timeout *pace_to;	/* Next admission */
+static struct l_timeout *sample_to;	/* CPU usage sampling */
+
+/* Ramp measurement */
+static bool ramping;
+static uint64_t ramp_begin;
+static uint64_t cpu_begin;
+static uint64_t cpu_last;
+static struct ramp_stats last_stats;
+
+static uint64_t cpu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return ts.tv_sec * (uint64_t) 1000000 + ts.tv_nsec / 1000;
+}
+
+static void stats_changed(const char *name)
+{
+	l_dbus_property_changed(dbus_get_bus(), "/", MANAGER_IFACE, name);
+}
+
+static void ramp_begin_measure(void)
+{
+	if (ramping)
+		return;
+
+	ramping = true;
+	ramp_begin = l_time_now();
+	cpu_begin = cpu_now();
+	cpu_last = cpu_begin;
+	last_stats.peak_cpu = 0;
+
+	l_timeout_modify(sample_to, 1);
+}
+
+static void ramp_end_measure(void)
+{
+	uint64_t now = l_time_now();
+
+	if (!ramping || waiting || active)
+		return;
+
+	ramping = false;
+	last_stats.duration = (now - ramp_begin) / 1000;
+	last_stats.cpu_time = (cpu_now() - cpu_begin) / 1000;
+
+	l_info("ramp: steady after %u ms, cpu %u ms, peak %u%%",
+	       last_stats.duration, last_stats.cpu_time,
+	       last_stats.peak_cpu);
+
+	stats_changed("RampDuration");
+	stats_changed("RampCpuTime");
+	stats_changed("RampPeakCpu");
+}
+
+static void sample_to_expired(struct l_timeout *timeout, void *user_data)
+{
+	uint64_t cpu;
+	uint32_t usage;
+
+	if (!ramping)
+		return;
+
+	/* Time used in the last second: percentage of one CPU */
+	cpu = cpu_now();
+	usage = (cpu - cpu_last) / 10000;
+	cpu_last = cpu;
+
+	if (usage > last_stats.peak_cpu)
+		last_stats.peak_cpu = usage;
+
+	l_timeout_modify(timeout, 1);
+}
+
+static struct ramp_req *next_request(void)
+{
+	int prio;
+
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++)
+		if (!l_queue_isempty(wait_list[prio]))
+			return l_queue_pop_head(wait_list[prio]);
+
+	return NULL;
+}
+
+static void admit(void)
+{
+	struct ramp_req *req;
+	uint64_t now;
+
+	while (waiting && (!max_active || active < (unsigned int) max_active)) {
+		now = l_time_now();
+		if (pace && last_admit && now < last_admit + pace) {
+			l_timeout_modify_ms(pace_to,
+					    (last_admit + pace - now + 999) / 1000);
+			return;
+		}
+
+		req = next_request();
+		waiting--;
+		active++;
+		req->admitted = true;
+		last_admit = now;
+
+		/* May release the request */
+		req->func(req->user_data);
+	}
+}
+
+static void pace_to_expired(struct l_timeout *timeout, void *user_data)
+{
+	admit();
+}
+
+int ramp_start(int concurrency, int rate)
+{
+	int prio;
+
+	l_info("Starting ramp ...");
+
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++)
+		wait_list[prio] = l_queue_new();
+
+	waiting = 0;
+	active = 0;
+	max_active = (concurrency > 0 ? concurrency : 0);
+	pace = (rate > 0 ? 1000000 / rate : 0);
+	last_admit = 0;
+	ramping = false;
+	memset(&last_stats, 0, sizeof(last_stats));
+
+	pace_to = l_timeout_create_ms(0, pace_to_expired, NULL, NULL);
+	sample_to = l_timeout_create(0, sample_to_expired, NULL, NULL);
+	if (!pace_to || !sample_to)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void ramp_stop(void)
+{
+	int prio;
+
+	/* Requests are released by their owners */
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++) {
+		l_queue_destroy(wait_list[prio], NULL);
+		wait_list[prio] = NULL;
+	}
+
+	l_timeout_remove(pace_to);
+	l_timeout_remove(sample_to);
+	pace_to = NULL;
+	sample_to = NULL;
+}
+
+struct ramp_req *ramp_request(int prio, ramp_func_t func, void *user_data)
+{
+	struct ramp_req *req;
+
+	if (prio < 0 || prio >= MODBUS_PRIORITY_MAX)
+		prio = MODBUS_PRIORITY_NORMAL;
+
+	req = l_new(struct ramp_req, 1);
+	req->prio = prio;
+	req->admitted = false;
+	req->func = func;
+	req->user_data = user_data;
+
+	ramp_begin_measure();
+
+	l_queue_push_tail(wait_list[prio], req);
+	waiting++;
+
+	/* Admitted on the next pace timeout: never from the caller */
+	l_timeout_modify_ms(pace_to, 1);
+
+	return req;
+}
+
+void ramp_release(struct ramp_req *req)
+{
+	if (unlikely(!req))
+		return;
+
+	if (req->admitted) {
+		active--;
+	} else if (wait_list[req->prio] &&
+		   l_queue_remove(wait_list[req->prio], req)) {
+		waiting--;
+	}
+
+	l_free(req);
+
+	if (pace_to && waiting)
+		l_timeout_modify_ms(pace_to, 1);
+
+	ramp_end_measure();
+}
+
+void ramp_get_stats(struct ramp_stats *stats)
+{
+	*stats = last_stats;
+}
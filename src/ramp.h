@@ -0,0 +1,47 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Connection ramp-up: slaves waiting to connect are admitted by priority
+ * class, at most 'concurrency' attempts in flight and 'rate' new attempts
+ * per second (zero: unlimited). Applied at startup and whenever many
+ * slaves reconnect at once. 'func' is called once the request is
+ * admitted; ramp_release() ends the attempt or cancels the request.
+ */
+
+typedef void (*ramp_func_t) (void *user_data);
+
+struct ramp_req;
+
+/* Last ramp: first request until nothing is waiting or connecting */
+struct ramp_stats {
+	uint32_t duration;		/* ms */
+	uint32_t cpu_time;		/* Process CPU time used, ms */
+	uint32_t peak_cpu;		/* Highest CPU usage over 1s, % */
+};
+
+int ramp_start(int concurrency, int rate);
+void ramp_stop(void);
+
+struct ramp_req *ramp_request(int prio, ramp_func_t func, void *user_data);
+void ramp_release(struct ramp_req *req);
+
+void ramp_get_stats(struct ramp_stats *stats);
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "options.h"
+#include "rtt.h"
+
+/* Clock granularity: lower bound of the variation term */
+#define RTT_GRANULARITY		1000	/* us */
+
+static uint32_t rto_clamp(uint64_t rto)
+{
+	uint64_t min = main_opts.timeout_min * (uint64_t) 1000;
+	uint64_t max = main_opts.timeout_max * (uint64_t) 1000;
+
+	if (rto < min)
+		return min;
+
+	if (rto > max)
+		return max;
+
+	return rto;
+}
+
+void rtt_init(struct rtt *rtt)
+{
+	rtt->srtt = 0;
+	rtt->rttvar = 0;
+	rtt->rto = rto_clamp(main_opts.timeout_initial * (uint64_t) 1000);
+	rtt->fixed = 0;
+}
+
+void rtt_sample(struct rtt *rtt, uint64_t us)
+{
+	uint32_t r = (us > UINT32_MAX / 2 ? UINT32_MAX / 2 : us);
+	uint32_t delta;
+	uint32_t var;
+
+	if (rtt->srtt == 0) {
+		/* First sample */
+		rtt->srtt = (r ? r : 1);
+		rtt->rttvar = r / 2;
+	} else {
+		delta = (rtt->srtt > r ? rtt->srtt - r : r - rtt->srtt);
+		rtt->rttvar = rtt->rttvar - (rtt->rttvar >> 2) + (delta >> 2);
+		rtt->srtt = rtt->srtt - (rtt->srtt >> 3) + (r >> 3);
+	}
+
+	var = 4 * rtt->rttvar;
+	rtt->rto = rto_clamp((uint64_t) rtt->srtt +
+			     (var > RTT_GRANULARITY ? var : RTT_GRANULARITY));
+}
+
+/* No response: back off until a response is received again */
+void rtt_expired(struct rtt *rtt)
+{
+	rtt->rto = rto_clamp(rtt->rto * (uint64_t) 2);
+}
+
+/* Response timeout in ms */
+uint32_t rtt_get_timeout(const struct rtt *rtt)
+{
+	if (rtt->fixed)
+		return rtt->fixed;
+
+	return (rtt->rto + 999) / 1000;
+}
+
+void rtt_set_timeout(struct rtt *rtt, uint32_t ms)
+{
+	rtt->fixed = ms;
+}
@@ -0,0 +1,41 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Response timeout estimation, TCP retransmission timer style (RFC 6298):
+ * smoothed round-trip time plus four times its variation, bounded by
+ * the [Timeout] settings. Missing responses double the timeout until
+ * the next sample. A non-zero override disables the estimation.
+ */
+
+struct rtt {
+	uint32_t srtt;		/* Smoothed round-trip time in us */
+	uint32_t rttvar;	/* Round-trip time variation in us */
+	uint32_t rto;		/* Estimated response timeout in us */
+	uint32_t fixed;		/* Override in ms, 0 if adaptive */
+};
+
+void rtt_init(struct rtt *rtt);
+void rtt_sample(struct rtt *rtt, uint64_t us);
+void rtt_expired(struct rtt *rtt);
+
+uint32_t rtt_get_timeout(const struct rtt *rtt);
+void rtt_set_timeout(struct rtt *rtt, uint32_t ms);
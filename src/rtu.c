@@ -28,6 +28,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <linux/serial.h>
@@ -38,9 +40,100 @@
 #include <modbus.h>
 
 #include "options.h"
+#include "worker.h"
+#include "rtt.h"
 #include "driver.h"
 
-static modbus_t *create(const char *url)
+/*
+ * libmodbus is blocking: transactions run at the worker thread and the
+ * response is copied to the caller buffer at the main loop.
+ *
+ * Slaves attached to the same serial port share a bus: one modbus
+ * context and one worker. Requests are queued per priority class and
+ * each worker job runs the highest priority request queued when it
+ * starts: transactions run back-to-back, selecting the unit id of each
+ * request and keeping the 3.5 character silent interval between frames.
+ */
+
+struct rtu_req;
+
+/* modbus context shared by the bus and its in-flight requests */
+struct rtu_conn {
+	int refs;
+	modbus_t *modbus;
+	long t35;			/* Inter-frame gap in ns */
+	struct timespec idle;		/* Bus silent since (worker only) */
+	pthread_mutex_t lock;		/* Protects the request queues */
+	struct rtu_req *head[MODBUS_PRIORITY_MAX];
+	struct rtu_req *tail[MODBUS_PRIORITY_MAX];
+};
+
+struct rtu_bus {
+	int refs;
+	char *url;			/* Also the bus key */
+	struct rtu_conn *conn;		/* Connected modbus context */
+	struct l_io *io;
+	struct worker *worker;		/* Transaction queue */
+	bool connecting;
+	struct l_queue *ctx_list;	/* Attached slaves */
+	struct l_queue *req_list;	/* Submitted requests */
+	unsigned int next_id;
+	uint32_t delay[MODBUS_PRIORITY_MAX];	/* Queueing delay average */
+};
+
+/* Per slave context attached to a bus */
+struct rtu_ctx {
+	struct rtu_bus *bus;
+	uint8_t id;
+	bool connected;
+	modbus_driver_func_t disconnected_cb;
+	void *user_data;
+	modbus_driver_func_t connect_cb;	/* Waiting for the bus */
+	void *connect_data;
+	struct rtt rtt;				/* Response timeout */
+};
+
+struct rtu_req {
+	struct rtu_ctx *ctx;		/* Don't touch at the worker */
+	struct rtu_conn *conn;
+	struct rtu_req *next;		/* Queue: protected by conn lock */
+	bool queued;			/* Not picked by a job yet */
+	unsigned int id;
+	uint8_t unit;
+	enum modbus_priority prio;
+	uint64_t queued_at;		/* Submission time (l_time_now) */
+	uint64_t started_at;		/* Transaction start */
+	uint32_t timeout;		/* Response timeout in ms */
+	uint64_t rtt;			/* Measured round-trip time in us */
+	enum modbus_table table;
+	uint16_t addr;
+	uint16_t nb;
+	void *out;			/* Caller buffer */
+	void *buffer;			/* Worker buffer */
+	size_t len;
+	int err;
+	bool cancelled;
+	modbus_driver_func_t func;
+	void *user_data;
+	modbus_driver_destroy_func_t destroy;
+};
+
+/* Worker job: runs the highest priority request queued at 'conn' */
+struct rtu_job {
+	struct rtu_conn *conn;
+	struct rtu_req *req;		/* Request run by this job */
+};
+
+struct rtu_connect {
+	struct rtu_bus *bus;		/* Don't touch at the worker */
+	char *url;
+	struct rtu_conn *conn;
+	int err;
+};
+
+static struct l_hashmap *bus_map;	/* url -> bus */
+
+static modbus_t *rtu_new(const char *url)
 {
 	struct serial_rs485 rs485conf;
 	modbus_t *ctx;
@@ -82,51 +175,749 @@ static modbus_t *create(const char *url)
 	return ctx;
 }
 
-static void destroy(modbus_t *ctx)
+static struct rtu_conn *conn_ref(struct rtu_conn *conn)
+{
+	__sync_fetch_and_add(&conn->refs, 1);
+
+	return conn;
+}
+
+static void conn_unref(struct rtu_conn *conn)
+{
+	if (__sync_sub_and_fetch(&conn->refs, 1))
+		return;
+
+	modbus_close(conn->modbus);
+	modbus_free(conn->modbus);
+	pthread_mutex_destroy(&conn->lock);
+	l_free(conn);
+}
+
+static void conn_push(struct rtu_conn *conn, struct rtu_req *req)
+{
+	pthread_mutex_lock(&conn->lock);
+
+	req->next = NULL;
+	req->queued = true;
+
+	if (conn->tail[req->prio])
+		conn->tail[req->prio]->next = req;
+	else
+		conn->head[req->prio] = req;
+
+	conn->tail[req->prio] = req;
+
+	pthread_mutex_unlock(&conn->lock);
+}
+
+/* Runs at the worker thread: higher classes first */
+static struct rtu_req *conn_pop(struct rtu_conn *conn)
+{
+	struct rtu_req *req = NULL;
+	int prio;
+
+	pthread_mutex_lock(&conn->lock);
+
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++) {
+		req = conn->head[prio];
+		if (!req)
+			continue;
+
+		conn->head[prio] = req->next;
+		if (!conn->head[prio])
+			conn->tail[prio] = NULL;
+
+		req->next = NULL;
+		req->queued = false;
+		break;
+	}
+
+	pthread_mutex_unlock(&conn->lock);
+
+	return req;
+}
+
+/* Return true if the request was still queued */
+static bool conn_remove(struct rtu_conn *conn, struct rtu_req *req)
+{
+	struct rtu_req *prev = NULL;
+	struct rtu_req *cur;
+	bool queued;
+
+	pthread_mutex_lock(&conn->lock);
+
+	queued = req->queued;
+	if (!queued)
+		goto done;
+
+	for (cur = conn->head[req->prio]; cur != req; cur = cur->next)
+		prev = cur;
+
+	if (prev)
+		prev->next = req->next;
+	else
+		conn->head[req->prio] = req->next;
+
+	if (conn->tail[req->prio] == req)
+		conn->tail[req->prio] = prev;
+
+	req->next = NULL;
+	req->queued = false;
+
+done:
+	pthread_mutex_unlock(&conn->lock);
+
+	return queued;
+}
+
+static void req_free(struct rtu_req *req)
+{
+	conn_unref(req->conn);
+	l_free(req->buffer);
+	l_free(req);
+}
+
+/*
+ * 3.5 characters at the configured baud rate. Above 19200 bps the
+ * specification recommends a fixed 1750 us.
+ */
+static long silent_interval(void)
+{
+	long bits;
+
+	if (serial_opts.baud <= 0 || serial_opts.baud > 19200)
+		return 1750000;
+
+	/* Start, data, parity and stop bits */
+	bits = 1 + serial_opts.data_bit + serial_opts.stop_bit +
+		(serial_opts.parity == 'N' ? 0 : 1);
+
+	return (long) ((35ULL * bits * 100000000ULL) / serial_opts.baud);
+}
+
+static bool id_cmp(const void *a, const void *b)
+{
+	const struct rtu_req *req = a;
+	unsigned int id = L_PTR_TO_UINT(b);
+
+	return (req->id == id ? true : false);
+}
+
+static int errno_to_err(int err)
+{
+	switch (err) {
+	case EMBXILADD:
+		return -EFAULT;
+	case EMBXILVAL:
+		return -EINVAL;
+	case ETIMEDOUT:
+		return -ETIMEDOUT;
+	default:
+		return -EIO;
+	}
+}
+
+/* Caller is not notified anymore: request may still be running */
+static void req_cancel(void *data)
+{
+	struct rtu_req *req = data;
+
+	__atomic_store_n(&req->cancelled, true, __ATOMIC_RELAXED);
+
+	if (req->destroy)
+		req->destroy(req->user_data);
+
+	/* Not picked by any job yet */
+	if (conn_remove(req->conn, req))
+		req_free(req);
+}
+
+static void req_fail(void *data, void *user_data)
+{
+	struct rtu_req *req = data;
+
+	if (req->func)
+		req->func(-ECONNRESET, req->user_data);
+
+	req_cancel(req);
+}
+
+static void ctx_disconnected(void *data, void *user_data)
+{
+	struct rtu_ctx *ctx = data;
+
+	if (!ctx->connected)
+		return;
+
+	ctx->connected = false;
+
+	if (ctx->disconnected_cb)
+		ctx->disconnected_cb(-ECONNRESET, ctx->user_data);
+}
+
+static void disconnect_cb(struct l_io *io, void *user_data)
+{
+	struct rtu_bus *bus = user_data;
+	struct l_queue *req_list = bus->req_list;
+
+	l_info("rtu(%s): disconnected", bus->url);
+
+	l_io_destroy(bus->io);
+	bus->io = NULL;
+
+	bus->req_list = l_queue_new();
+	l_queue_foreach(req_list, req_fail, NULL);
+	l_queue_destroy(req_list, NULL);
+
+	/* Drop pending requests: context is released after in-flight */
+	worker_flush(bus->worker);
+	conn_unref(bus->conn);
+	bus->conn = NULL;
+
+	l_queue_foreach(bus->ctx_list, ctx_disconnected, NULL);
+}
+
+/* Runs at the worker thread */
+static void connect_exec(void *user_data)
+{
+	struct rtu_connect *conn = user_data;
+	modbus_t *modbus;
+
+	modbus = rtu_new(conn->url);
+	if (!modbus) {
+		/* FIXME: URL may be invalid. How to handle this scenario? */
+		conn->err = -EINVAL;
+		return;
+	}
+
+	if (modbus_connect(modbus) == -1) {
+		/* Releasing connection */
+		conn->err = -errno;
+		modbus_free(modbus);
+		return;
+	}
+
+	conn->conn = l_new(struct rtu_conn, 1);
+	conn->conn->refs = 1;
+	pthread_mutex_init(&conn->conn->lock, NULL);
+	conn->conn->modbus = modbus;
+	conn->conn->t35 = silent_interval();
+	clock_gettime(CLOCK_MONOTONIC, &conn->conn->idle);
+	conn->err = 0;
+}
+
+static void ctx_connected(void *data, void *user_data)
+{
+	struct rtu_ctx *ctx = data;
+	int err = L_PTR_TO_INT(user_data);
+	modbus_driver_func_t func = ctx->connect_cb;
+
+	/* Not waiting for the bus */
+	if (!func)
+		return;
+
+	ctx->connect_cb = NULL;
+	ctx->connected = (err == 0);
+
+	func(err, ctx->connect_data);
+}
+
+static void connect_done(void *user_data)
+{
+	struct rtu_connect *conn = user_data;
+	struct rtu_bus *bus = conn->bus;
+
+	bus->connecting = false;
+
+	if (conn->err < 0) {
+		l_info("connect(%s): %s(%d)", bus->url,
+		       strerror(-conn->err), -conn->err);
+		goto done;
+	}
+
+	bus->io = l_io_new(modbus_get_socket(conn->conn->modbus));
+	if (!bus->io) {
+		conn->err = -EIO;
+		goto done;
+	}
+
+	l_io_set_disconnect_handler(bus->io, disconnect_cb, bus, NULL);
+
+	bus->conn = conn->conn;
+	conn->conn = NULL;
+
+done:
+	/* Every slave waiting for this bus */
+	l_queue_foreach(bus->ctx_list, ctx_connected,
+			L_INT_TO_PTR(conn->err));
+}
+
+static void connect_free(void *user_data)
 {
-	modbus_close(ctx);
-	modbus_free(ctx);
+	struct rtu_connect *conn = user_data;
+
+	if (conn->conn)
+		conn_unref(conn->conn);
+
+	l_free(conn->url);
+	l_free(conn);
+}
+
+/* Runs at the worker thread: keep the bus silent for 3.5 characters */
+static void bus_wait_idle(struct rtu_conn *conn)
+{
+	struct timespec ts = conn->idle;
+
+	ts.tv_nsec += conn->t35;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			       &ts, NULL) == EINTR)
+		;
 }
 
-static int read_bool(modbus_t *ctx, uint16_t addr, bool *out)
+/* Runs at the worker thread */
+/* In place: LSB of the first byte is the first bit, as on the wire */
+static void pack_bits(uint8_t *bits, uint16_t nb)
 {
-	uint8_t val_u8 = 0;
+	uint8_t byte = 0;
+	int i;
+
+	for (i = 0; i < nb; i++) {
+		byte |= (bits[i] ? 1 : 0) << (i % 8);
+		if (i % 8 == 7 || i == nb - 1) {
+			bits[i / 8] = byte;
+			byte = 0;
+		}
+	}
+}
+
+static void read_exec(void *user_data)
+{
+	struct rtu_job *job = user_data;
+	modbus_t *modbus = job->conn->modbus;
+	struct rtu_req *req;
+	uint64_t sent_at;
+	uint64_t byte;
 	int ret;
 
-	ret = modbus_read_input_bits(ctx, addr, 1, &val_u8);
-	if (ret > 0)
-		*out = (val_u8 ? true : false);
+	/* Cancelled requests are not queued anymore */
+	req = conn_pop(job->conn);
+	if (!req)
+		return;
+
+	job->req = req;
+	req->started_at = l_time_now();
+
+	/* Cancelled meanwhile: don't waste bus time */
+	if (__atomic_load_n(&req->cancelled, __ATOMIC_RELAXED)) {
+		req->err = -ECANCELED;
+		return;
+	}
+
+	bus_wait_idle(job->conn);
+
+	/* Byte timeout: quarter of the response one, two gaps at least */
+	byte = req->timeout * (uint64_t) 1000 / 4;
+	if (byte < (uint64_t) job->conn->t35 / 500)
+		byte = job->conn->t35 / 500;
 
-	return ret;
+	modbus_set_response_timeout(modbus, req->timeout / 1000,
+				    (req->timeout % 1000) * 1000);
+	modbus_set_byte_timeout(modbus, byte / 1000000, byte % 1000000);
+	modbus_set_slave(modbus, req->unit);
+
+	sent_at = l_time_now();
+
+	switch (req->table) {
+	case MODBUS_TABLE_COILS:
+		ret = modbus_read_bits(modbus, req->addr,
+				       req->nb, req->buffer);
+		break;
+	case MODBUS_TABLE_DISCRETE_INPUTS:
+		ret = modbus_read_input_bits(modbus, req->addr,
+					     req->nb, req->buffer);
+		break;
+	case MODBUS_TABLE_INPUT_REGISTERS:
+		ret = modbus_read_input_registers(modbus, req->addr,
+						  req->nb, req->buffer);
+		break;
+	case MODBUS_TABLE_HOLDING_REGISTERS:
+	case MODBUS_TABLE_MAX:
+	default:
+		ret = modbus_read_registers(modbus, req->addr,
+					    req->nb, req->buffer);
+		break;
+	}
+
+	req->rtt = l_time_now() - sent_at;
+	req->err = (ret == -1 ? errno_to_err(errno) : 0);
+
+	if (ret != -1 && MODBUS_TABLE_IS_BITS(req->table))
+		pack_bits(req->buffer, req->nb);
+
+	/* Late or corrupted frames must not reach the next transaction */
+	if (ret == -1 && errno != EMBXILADD && errno != EMBXILVAL)
+		modbus_flush(modbus);
+
+	clock_gettime(CLOCK_MONOTONIC, &job->conn->idle);
 }
 
-static int read_byte(modbus_t *ctx, uint16_t addr, uint8_t *out)
+static void read_done(void *user_data)
 {
-	return modbus_read_input_bits(ctx, addr, 8, out);
+	struct rtu_job *job = user_data;
+	struct rtu_req *req = job->req;
+	struct rtu_bus *bus;
+	uint64_t delay;
+
+	if (!req || req->cancelled)
+		return;
+
+	bus = req->ctx->bus;
+	l_queue_remove(bus->req_list, req);
+
+	/* Moving average: 1/8 of the new sample */
+	delay = req->started_at - req->queued_at;
+	if (delay > UINT32_MAX)
+		delay = UINT32_MAX;
+
+	bus->delay[req->prio] = bus->delay[req->prio] -
+		(bus->delay[req->prio] >> 3) + ((uint32_t) delay >> 3);
+
+	/* Exceptions are answers too */
+	if (req->err == 0 || req->err == -EFAULT || req->err == -EINVAL)
+		rtt_sample(&req->ctx->rtt, req->rtt);
+	else if (req->err == -ETIMEDOUT)
+		rtt_expired(&req->ctx->rtt);
+
+	if (req->err == 0)
+		memcpy(req->out, req->buffer, req->len);
+
+	if (req->func)
+		req->func(req->err, req->user_data);
+
+	req_cancel(req);
 }
 
-static int read_u16(modbus_t *ctx, uint16_t addr, uint16_t *out)
+static void read_free(void *user_data)
 {
-	return modbus_read_registers(ctx, addr, 1, out);
+	struct rtu_job *job = user_data;
+	struct rtu_req *req = job->req;
+
+	if (req) {
+		/* Flushed or context destroyed: caller still waiting */
+		if (!req->cancelled && req->destroy)
+			req->destroy(req->user_data);
+
+		req_free(req);
+	}
+
+	conn_unref(job->conn);
+	l_free(job);
 }
 
-static int read_u32(modbus_t *ctx, uint16_t addr, uint32_t *out)
+static struct rtu_bus *bus_new(const char *url)
 {
-	return modbus_read_registers(ctx, addr, 2, (uint16_t *) out);
+	struct rtu_bus *bus;
+
+	bus = l_new(struct rtu_bus, 1);
+	bus->refs = 0;
+	bus->url = l_strdup(url);
+	bus->conn = NULL;
+	bus->io = NULL;
+	bus->worker = worker_new();
+	bus->connecting = false;
+	bus->ctx_list = l_queue_new();
+	bus->req_list = l_queue_new();
+	bus->next_id = 1;
+	memset(bus->delay, 0, sizeof(bus->delay));
+
+	if (!bus_map)
+		bus_map = l_hashmap_string_new();
+
+	l_hashmap_insert(bus_map, bus->url, bus);
+
+	return bus;
 }
 
-static int read_u64(modbus_t *ctx, uint16_t addr, uint64_t *out)
+static struct rtu_bus *bus_ref(struct rtu_bus *bus)
 {
-	return modbus_read_registers(ctx, addr, 4, (uint16_t *) out);
+	__sync_fetch_and_add(&bus->refs, 1);
+
+	return bus;
+}
+
+static void bus_unref(struct rtu_bus *bus)
+{
+	if (__sync_sub_and_fetch(&bus->refs, 1))
+		return;
+
+	l_info("rtu(%s): releasing bus", bus->url);
+
+	l_hashmap_remove(bus_map, bus->url);
+
+	/* In-flight request keeps a reference to the modbus context */
+	worker_destroy(bus->worker);
+
+	if (bus->io) {
+		l_io_set_disconnect_handler(bus->io, NULL, NULL, NULL);
+		l_io_destroy(bus->io);
+	}
+
+	if (bus->conn)
+		conn_unref(bus->conn);
+
+	/* Requests have been cancelled by their owners */
+	l_queue_destroy(bus->req_list, NULL);
+	l_queue_destroy(bus->ctx_list, NULL);
+
+	l_free(bus->url);
+	l_free(bus);
+}
+
+static void *create(const char *url, uint8_t id,
+		    modbus_driver_func_t disconnected_cb, void *user_data)
+{
+	struct rtu_bus *bus;
+	struct rtu_ctx *ctx;
+
+	/* Slaves on the same serial port share the bus */
+	bus = (bus_map ? l_hashmap_lookup(bus_map, url) : NULL);
+	if (!bus)
+		bus = bus_new(url);
+
+	ctx = l_new(struct rtu_ctx, 1);
+	ctx->bus = bus_ref(bus);
+	ctx->id = id;
+	ctx->connected = false;
+	ctx->disconnected_cb = disconnected_cb;
+	ctx->user_data = user_data;
+	ctx->connect_cb = NULL;
+	ctx->connect_data = NULL;
+	rtt_init(&ctx->rtt);
+
+	l_queue_push_tail(bus->ctx_list, ctx);
+
+	return ctx;
+}
+
+static bool req_owner_cmp(const void *a, const void *b)
+{
+	const struct rtu_req *req = a;
+
+	return (req->ctx == b ? true : false);
+}
+
+static void destroy(void *user_data)
+{
+	struct rtu_ctx *ctx = user_data;
+	struct rtu_bus *bus = ctx->bus;
+	struct rtu_req *req;
+
+	/* Release requests owned by this slave only */
+	while ((req = l_queue_remove_if(bus->req_list, req_owner_cmp, ctx)))
+		req_cancel(req);
+
+	l_queue_remove(bus->ctx_list, ctx);
+	l_free(ctx);
+
+	bus_unref(bus);
+}
+
+static int rtu_connect(void *user_data, modbus_driver_func_t func,
+		       void *func_data)
+{
+	struct rtu_ctx *ctx = user_data;
+	struct rtu_bus *bus = ctx->bus;
+	struct rtu_connect *conn;
+
+	if (ctx->connected)
+		return -EISCONN;
+
+	if (ctx->connect_cb)
+		return -EALREADY;
+
+	ctx->connect_cb = func;
+	ctx->connect_data = func_data;
+
+	/* Bus already opened by another slave */
+	if (bus->conn) {
+		ctx_connected(ctx, L_INT_TO_PTR(0));
+		return 0;
+	}
+
+	if (bus->connecting)
+		return 0;
+
+	conn = l_new(struct rtu_connect, 1);
+	conn->bus = bus;
+	conn->url = l_strdup(bus->url);
+	conn->conn = NULL;
+	conn->err = 0;
+
+	if (!worker_submit(bus->worker, connect_exec,
+			   connect_done, conn, connect_free)) {
+		ctx->connect_cb = NULL;
+		connect_free(conn);
+		return -EIO;
+	}
+
+	bus->connecting = true;
+
+	return 0;
+}
+
+static unsigned int submit(struct rtu_ctx *ctx, enum modbus_table table,
+			   uint16_t addr, uint16_t nb,
+			   enum modbus_priority prio,
+			   void *out, modbus_driver_func_t func,
+			   void *user_data,
+			   modbus_driver_destroy_func_t destroy)
+{
+	struct rtu_bus *bus = ctx->bus;
+	struct rtu_req *req;
+	struct rtu_job *job;
+
+	if (!ctx->connected || !bus->conn || prio >= MODBUS_PRIORITY_MAX)
+		return 0;
+
+	req = l_new(struct rtu_req, 1);
+	req->ctx = ctx;
+	req->conn = conn_ref(bus->conn);
+	req->next = NULL;
+	req->queued = false;
+	req->id = bus->next_id++;
+	req->unit = ctx->id;
+	req->prio = prio;
+	req->queued_at = l_time_now();
+	req->timeout = rtt_get_timeout(&ctx->rtt);
+	req->rtt = 0;
+	req->table = table;
+	req->addr = addr;
+	req->nb = nb;
+	req->out = out;
+	/* libmodbus writes one byte per bit: packed by the worker */
+	if (MODBUS_TABLE_IS_BITS(table)) {
+		req->len = (nb + 7) / 8;
+		req->buffer = l_malloc(nb);
+	} else {
+		req->len = nb * sizeof(uint16_t);
+		req->buffer = l_malloc(req->len);
+	}
+	req->cancelled = false;
+	req->func = func;
+	req->user_data = user_data;
+	req->destroy = destroy;
+
+	/* Skip zero: invalid id */
+	if (bus->next_id == 0)
+		bus->next_id = 1;
+
+	conn_push(bus->conn, req);
+
+	/* One job per request: the job picks the request to run */
+	job = l_new(struct rtu_job, 1);
+	job->conn = conn_ref(bus->conn);
+	job->req = NULL;
+
+	if (!worker_submit(bus->worker, read_exec,
+			   read_done, job, read_free)) {
+		conn_remove(bus->conn, req);
+		req_free(req);
+		read_free(job);
+		return 0;
+	}
+
+	l_queue_push_tail(bus->req_list, req);
+
+	return req->id;
+}
+
+static unsigned int read_bits(void *ctx, enum modbus_table table,
+			      uint16_t addr, uint16_t nb,
+			      enum modbus_priority prio, uint8_t *out,
+			      modbus_driver_func_t func,
+			      void *user_data,
+			      modbus_driver_destroy_func_t destroy)
+{
+	if (nb == 0 || nb > MODBUS_MAX_READ_BITS ||
+	    !MODBUS_TABLE_IS_BITS(table))
+		return 0;
+
+	return submit(ctx, table, addr, nb, prio, out,
+		      func, user_data, destroy);
+}
+
+static unsigned int read_registers(void *ctx, enum modbus_table table,
+				   uint16_t addr, uint16_t nb,
+				   enum modbus_priority prio, uint16_t *out,
+				   modbus_driver_func_t func,
+				   void *user_data,
+				   modbus_driver_destroy_func_t destroy)
+{
+	if (nb == 0 || nb > MODBUS_MAX_READ_REGISTERS ||
+	    MODBUS_TABLE_IS_BITS(table) || table >= MODBUS_TABLE_MAX)
+		return 0;
+
+	return submit(ctx, table, addr, nb, prio, out,
+		      func, user_data, destroy);
+}
+
+static void cancel(void *user_data, unsigned int id)
+{
+	struct rtu_ctx *ctx = user_data;
+	struct rtu_req *req;
+
+	req = l_queue_remove_if(ctx->bus->req_list, id_cmp,
+				L_UINT_TO_PTR(id));
+	if (req)
+		req_cancel(req);
+}
+
+static uint32_t queue_delay(void *user_data, enum modbus_priority prio)
+{
+	struct rtu_ctx *ctx = user_data;
+
+	if (prio >= MODBUS_PRIORITY_MAX)
+		return 0;
+
+	return ctx->bus->delay[prio];
+}
+
+static void set_timeout(void *user_data, uint32_t ms)
+{
+	struct rtu_ctx *ctx = user_data;
+
+	rtt_set_timeout(&ctx->rtt, ms);
+}
+
+static uint32_t get_timeout(void *user_data)
+{
+	struct rtu_ctx *ctx = user_data;
+
+	return rtt_get_timeout(&ctx->rtt);
+}
+
+static uint32_t get_rtt(void *user_data)
+{
+	struct rtu_ctx *ctx = user_data;
+
+	return ctx->rtt.srtt;
 }
 
 struct modbus_driver rtu = {
 	.name = "rtu",
 	.create = create,
 	.destroy = destroy,
-	.read_bool = read_bool,
-	.read_byte = read_byte,
-	.read_u16 = read_u16,
-	.read_u32 = read_u32,
-	.read_u64 = read_u64,
+	.connect = rtu_connect,
+	.read_bits = read_bits,
+	.read_registers = read_registers,
+	.cancel = cancel,
+	.queue_delay = queue_delay,
+	.set_timeout = set_timeout,
+	.get_timeout = get_timeout,
+	.get_rtt = get_rtt,
 };
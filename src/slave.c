@@ -25,21 +25,46 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include <ell/ell.h>
 
-#include <modbus.h>
 #include <string.h>
 
 #include "dbus.h"
+#include "options.h"
 #include "storage.h"
 #include "source.h"
+#include "block.h"
+#include "devlimits.h"
+#include "image.h"
+#include "bucket.h"
+#include "load.h"
+#include "timer.h"
+#include "snapshot.h"
+#include "ramp.h"
+#include "worker.h"
 #include "driver.h"
 #include "slave.h"
 
+/* Request budgets: slave, link (or bus) and daemon-wide */
+enum budget {
+	BUDGET_SLAVE,
+	BUDGET_LINK,
+	BUDGET_GLOBAL,
+	BUDGET_MAX,
+};
+
+static const char *budget_str[] = {
+	[BUDGET_SLAVE] = "slave",
+	[BUDGET_LINK] = "link",
+	[BUDGET_GLOBAL] = "global",
+};
+
 struct slave {
 	int refs;
 	char *key;	/* Local random id */
@@ -52,20 +77,65 @@ struct slave {
 	 * "serial://dev/ttyUSBx:115200,'N',8,1"
 	 */
 	char *url;
-	modbus_t *modbus;
-	struct l_io *io; /* TCP IO channel */
+	void *ctx;			/* Driver context */
+	bool online;			/* Connected to slave */
 	struct l_queue *source_list;	/* Child sources */
-	struct l_hashmap *to_list;	/* Reading/Polling timeout */
+	struct l_queue *block_list;	/* Read plan: blocks of sources */
+	struct image *image;		/* Register image: source values */
+	struct l_queue *bond_list;	/* Reading/Polling timeout */
 	int src_storage;		/* Source storage id */
+	struct devlimits *limits;		/* Learned device read limits */
+	uint16_t max_ok[MODBUS_TABLE_MAX];	/* Largest successful reading */
+	struct l_idle *replan;		/* New read plan pending */
+	struct l_queue *hole_list;	/* Suspected unreadable: reading */
 	struct l_timeout *poll_to;	/* Connection attempt timeout */
 	struct modbus_driver *drv;	/* TCP or Serial */
+	struct bucket *bucket[BUDGET_MAX];	/* Request rate limits */
+	struct load *load;		/* Link load shedding */
+	unsigned int retries;		/* Consecutive failed attempts */
+	uint32_t retry_delay;		/* Current backoff in ms */
+	unsigned int timeouts;		/* Consecutive reading timeouts */
+	bool breaker;			/* Circuit open: readings suspended */
+	unsigned int probe_id;		/* Breaker probe in progress */
+	uint16_t probe;			/* Breaker probe response */
+	struct ramp_req *ramp;		/* Waiting or holding a connect slot */
+};
+
+/* Reading of a suspected unreadable range */
+struct hole_probe {
+	struct slave *slave;
+	int table;
+	uint16_t first;
+	uint16_t last;			/* Inclusive */
+	uint16_t max;			/* Quantity fallback if readable */
+	unsigned int id;
+	void *buffer;
+};
+
+/* Gaps of a block rejected with an illegal data address exception */
+struct gap_search {
+	struct slave *slave;
+	uint16_t max;			/* Quantity fallback if readable */
+	bool found;			/* New suspected range */
 };
 
 struct bond {
 	struct slave *slave;
-	struct source *source;
+	struct block *block;
+	struct timer_node timer;	/* Polling deadline */
+	uint64_t deadline;		/* Next reading (l_time_now) */
+	uint64_t last;			/* Deadline of the last reading */
+	unsigned int missed;		/* Catch up: readings owed */
+	bool stretched;			/* Stretch: waiting the reading */
+	bool triggered;			/* Read on trigger changes only */
+	unsigned int req_id;		/* Reading in progress */
+	uint64_t stamp;			/* Snapshot: next wall clock boundary */
+	uint64_t read_stamp;		/* Snapshot: boundary being read */
 };
 
+/* Catch up: limit back-to-back readings after a long stall */
+#define CATCHUP_MAX	8
+
 extern struct modbus_driver tcp;
 extern struct modbus_driver rtu;
 
@@ -80,42 +150,95 @@ static bool path_cmp(const void *a, const void *b)
 	return (strcmp(source_get_path(source), b1) == 0 ? true : false);
 }
 
-static bool address_cmp(const void *a, const void *b)
+/* Sources are identified by table and address */
+struct source_key {
+	int table;
+	uint16_t address;
+};
+
+static bool key_cmp(const void *a, const void *b)
 {
 	const struct source *source = a;
-	uint16_t address = L_PTR_TO_INT(b);
+	const struct source_key *key = b;
 
-	return (source_get_address(source) == address ? true : false);
+	return (source_get_table(source) == key->table &&
+		source_get_address(source) == key->address ? true : false);
 }
 
-static void timeout_destroy(void *data)
+/* Wall clock in us since epoch: snapshot boundaries */
+static uint64_t time_realtime(void)
 {
-	struct l_timeout *timeout = data;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
 
-	l_timeout_remove(timeout);
+	return ts.tv_sec * (uint64_t) 1000000 + ts.tv_nsec / 1000;
+}
+
+static void bond_destroy(void *data)
+{
+	struct bond *bond = data;
+	struct slave *slave = bond->slave;
+
+	/* Response must not be written to the released block */
+	if (bond->req_id)
+		slave->drv->cancel(slave->ctx, bond->req_id);
+
+	timer_cancel(&bond->timer);
+	l_free(bond);
 }
 
 static void entry_destroy(void *user_data)
 {
 	struct source *source = user_data;
 
+	snapshot_remove(source_get_snapshot(source), source);
+
 	/* Don't remove from storage */
 	source_destroy(source, false);
 }
 
+/* Detached: completes after the slave is gone */
+static void hole_probe_cancel(void *data)
+{
+	struct hole_probe *probe = data;
+	struct slave *slave = probe->slave;
+
+	probe->slave = NULL;
+	slave->drv->cancel(slave->ctx, probe->id);
+}
+
 static void slave_free(struct slave *slave)
 {
+	int i;
+
+	l_queue_destroy(slave->bond_list, bond_destroy);
+	l_queue_destroy(slave->block_list, block_destroy);
 	l_queue_destroy(slave->source_list, entry_destroy);
-	l_hashmap_destroy(slave->to_list, timeout_destroy);
 
-	if (slave->io)
-		l_io_destroy(slave->io);
-	if (slave->modbus)
-		slave->drv->destroy(slave->modbus);
+	if (slave->probe_id)
+		slave->drv->cancel(slave->ctx, slave->probe_id);
+
+	l_queue_destroy(slave->hole_list, hole_probe_cancel);
+
+	ramp_release(slave->ramp);
+
+	if (slave->ctx)
+		slave->drv->destroy(slave->ctx);
 
 	if (slave->poll_to)
 		l_timeout_remove(slave->poll_to);
 
+	for (i = 0; i < BUDGET_MAX; i++)
+		bucket_unref(slave->bucket[i]);
+
+	load_put(slave->load, slave);
+
+	if (slave->replan)
+		l_idle_remove(slave->replan);
+
+	devlimits_free(slave->limits);
+	image_free(slave->image);
 	storage_close(slave->src_storage);
 	l_free(slave->key);
 	l_free(slave->url);
@@ -141,215 +264,1068 @@ static void slave_unref(struct slave *slave)
 	if (unlikely(!slave))
 		return;
 
-	l_info("slave_unref(%p): %d", slave, slave->refs - 1);
-	if (__sync_sub_and_fetch(&slave->refs, 1))
-		return;
+	l_info("slave_unref(%p): %d", slave, slave->refs - 1);
+	if (__sync_sub_and_fetch(&slave->refs, 1))
+		return;
+
+	slave_free(slave);
+}
+
+static void create_slave_from_storage(const char *key,
+				int slave_id,
+				const char *name,
+				const char *url,
+				void *user_data)
+{
+	struct l_queue *list = user_data;
+	struct slave *slave;
+
+	slave = slave_create(key, slave_id, name, url);
+	if (!slave)
+		return;
+
+	l_queue_push_head(list, slave);
+}
+
+static void bond_read(struct bond *bond);
+
+static void bond_trigger(struct bond *bond)
+{
+	/* Reading in progress: read again once it completes */
+	if (bond->req_id) {
+		bond->missed = 1;
+		return;
+	}
+
+	bond_read(bond);
+}
+
+/* Hooked to value changes: reads the blocks triggered by 'source' */
+static void source_changed(struct source *source, uint64_t value,
+			   void *user_data)
+{
+	struct slave *slave = user_data;
+	const struct l_queue_entry *entry;
+	struct bond *bond;
+	uint64_t mask;
+
+	for (entry = l_queue_get_entries(slave->bond_list);
+	     entry; entry = entry->next) {
+		bond = entry->data;
+		if (!bond->triggered ||
+		    block_get_trigger_table(bond->block) !=
+						source_get_table(source) ||
+		    block_get_trigger(bond->block) !=
+						source_get_address(source))
+			continue;
+
+		/* Mask: read while any of the masked bits is set */
+		mask = block_get_trigger_mask(bond->block);
+		if (mask && !(value & mask))
+			continue;
+
+		bond_trigger(bond);
+	}
+}
+
+/*
+ * Trigger stored or requested without its table: the discrete input or
+ * holding register at 'trigger', sharing the plain storage group.
+ */
+static int trigger_table_default(struct slave *slave, uint16_t trigger)
+{
+	char group[16];
+	char *str;
+	int table = -ENOENT;
+
+	snprintf(group, sizeof(group), "0x%04x", trigger);
+
+	str = storage_read_key_string(slave->src_storage, group, "Table");
+	if (str) {
+		table = source_table_from_string(str);
+		l_free(str);
+		return table;
+	}
+
+	/* Stored before tables were configurable */
+	str = storage_read_key_string(slave->src_storage, group, "Type");
+	if (str) {
+		table = source_table_default(str);
+		l_free(str);
+	}
+
+	return table;
+}
+
+static void create_source_from_storage(const char *address,
+				const char *name,
+				const char *type,
+				const char *unit,
+				int interval,
+				void *user_data)
+{
+	struct slave *slave = user_data;
+	struct source *source;
+	const char *prefix;
+	unsigned int uaddr;
+	int max_interval = 0;
+	bool aligned = false;
+	char *priority;
+	char *snapshot;
+	char *table_str;
+	int table;
+	int trigger_table;
+	int trigger = 0xffff;
+	uint64_t mask = 0;
+
+	/* Group: address, prefixed for coils and input registers */
+	prefix = strrchr(address, '_');
+	if (sscanf(prefix ? prefix + 1 : address, "0x%04x", &uaddr) != 1)
+		return;
+
+	/* Missing before tables were configurable */
+	table = source_table_default(type);
+	table_str = storage_read_key_string(slave->src_storage, address,
+					    "Table");
+	if (table_str) {
+		table = source_table_from_string(table_str);
+		l_free(table_str);
+	}
+
+	if (!source_table_is_valid(table, type)) {
+		l_error("storage: invalid table (%s)", address);
+		return;
+	}
+
+	source = source_create(slave->path, name, type, unit, table, uaddr,
+			       interval, slave->src_storage, false);
+	if (!source)
+		return;
+
+	storage_read_key_int(slave->src_storage, address,
+			     "MaxPollingInterval", &max_interval);
+	source_set_max_interval(source, max_interval, false);
+
+	storage_read_key_bool(slave->src_storage, address,
+			      "PhaseAligned", &aligned);
+	source_set_phase_aligned(source, aligned, false);
+
+	priority = storage_read_key_string(slave->src_storage, address,
+					   "Priority");
+	if (priority) {
+		source_set_priority(source,
+				    source_priority_from_string(priority),
+				    false);
+		l_free(priority);
+	}
+
+	snapshot = storage_read_key_string(slave->src_storage, address,
+					   "Snapshot");
+	if (snapshot) {
+		source_set_snapshot(source, snapshot, false);
+		l_free(snapshot);
+	}
+
+	storage_read_key_int(slave->src_storage, address, "Trigger", &trigger);
+	storage_read_key_uint64(slave->src_storage, address, "TriggerMask",
+				&mask);
+
+	table_str = storage_read_key_string(slave->src_storage, address,
+					    "TriggerTable");
+	if (table_str) {
+		trigger_table = source_table_from_string(table_str);
+		l_free(table_str);
+	} else if (trigger != 0xffff) {
+		trigger_table = trigger_table_default(slave, trigger);
+	} else {
+		trigger_table = table;
+	}
+
+	/* Unknown trigger source: polled at its interval */
+	if (trigger_table < 0) {
+		trigger_table = table;
+		trigger = 0xffff;
+	}
+
+	source_set_trigger(source, trigger_table, trigger, mask, false);
+	source_set_changed_func(source, source_changed, slave);
+
+	/* Group interval changed meanwhile: polled on its own */
+	if (source_get_snapshot(source) &&
+	    snapshot_add(source_get_snapshot(source), source) < 0) {
+		l_error("source %s: can't join snapshot %s",
+			source_get_path(source), source_get_snapshot(source));
+		source_set_snapshot(source, NULL, false);
+	}
+
+	l_queue_push_head(slave->source_list, source);
+}
+
+/* Offline: deadlines advance, timers are armed on resume */
+static void bond_schedule(struct bond *bond)
+{
+	if (!bond->slave->online)
+		return;
+
+	timer_arm(&bond->timer, bond->deadline);
+}
+
+static void read_cb(int err, void *user_data);
+static void learn_limits(struct slave *slave, struct block *block, int err);
+
+static void bond_read(struct bond *bond)
+{
+	struct block *block = bond->block;
+	struct slave *slave = bond->slave;
+	struct modbus_driver *driver = slave->drv;
+	uint16_t addr = block_get_address(block);
+	uint16_t size = block_get_size(block);
+	int prio = block_get_priority(block);
+	uint64_t now = l_time_now();
+	uint64_t delay;
+
+	/* Circuit open: only the probe reaches the slave */
+	if (slave->breaker)
+		return;
+
+	/* Lower classes leave one request to critical sources */
+	if (!bucket_take(slave->bucket, BUDGET_MAX, now,
+			 prio == MODBUS_PRIORITY_CRITICAL ? 0 : 1, &delay)) {
+		/* Snapshot: boundary skipped, already scheduled */
+		if (block_get_snapshot(block)) {
+			l_info("block %p: over budget, boundary skipped",
+			       block);
+			return;
+		}
+
+		/* Over budget: stretch the interval, nothing owed */
+		l_info("block %p: over budget, delayed %" PRIu64 " us",
+		       block, delay);
+		bond->missed = 0;
+		bond->deadline = now + delay;
+		bond_schedule(bond);
+		return;
+	}
+
+	l_info("modbus reading block %p addr:(0x%x) size:%d",
+	       block, addr, size);
+
+	if (block_is_bits(block))
+		bond->req_id = driver->read_bits(slave->ctx,
+						 block_get_table(block),
+						 addr, size, prio,
+						 block_get_buffer(block),
+						 read_cb, bond, NULL);
+	else
+		bond->req_id = driver->read_registers(slave->ctx,
+						      block_get_table(block),
+						      addr, size, prio,
+						      block_get_buffer(block),
+						      read_cb, bond, NULL);
+
+	if (!bond->req_id)
+		l_error("read(%x): can't submit request", addr);
+}
+
+static void snapshot_read(struct bond *bond)
+{
+	const struct l_queue_entry *entry;
+	const char *name = block_get_snapshot(bond->block);
+	uint64_t now = time_realtime();
+
+	block_decode(bond->block, bond->slave->image);
+
+	for (entry = l_queue_get_entries(block_get_source_list(bond->block));
+	     entry; entry = entry->next)
+		snapshot_update(name, entry->data, bond->read_stamp, now);
+}
+
+static void breaker_open(struct slave *slave);
+
+/* Exceptions are answers: the slave is alive */
+static void breaker_account(struct slave *slave, int err)
+{
+	if (err == -ETIMEDOUT) {
+		slave->timeouts++;
+		if (main_opts.breaker_timeouts && !slave->breaker &&
+		    slave->timeouts >= (unsigned int) main_opts.breaker_timeouts)
+			breaker_open(slave);
+	} else if (err == 0 || err == -EFAULT || err == -EINVAL) {
+		slave->timeouts = 0;
+	}
+}
+
+static void read_cb(int err, void *user_data)
+{
+	struct bond *bond = user_data;
+	struct block *block = bond->block;
+	struct image *image = bond->slave->image;
+	uint16_t period = block_get_period(block);
+	uint64_t deadline;
+	uint64_t now;
+
+	bond->req_id = 0;
+
+	breaker_account(bond->slave, err);
+	learn_limits(bond->slave, block, err);
+
+	if (err < 0) {
+		l_error("read(%x): %s(%d)", block_get_address(block),
+			strerror(-err), -err);
+	} else if (block_get_snapshot(block)) {
+		/* Fixed boundaries: not adaptive */
+		snapshot_read(bond);
+	} else if (bond->triggered) {
+		block_decode(block, image);
+	} else if (block_adapt(block, block_decode(block, image)) < period) {
+		/* Value changed while backing off: read sooner */
+		deadline = bond->last +
+			block_get_period(block) * (uint64_t) 1000;
+		if (deadline < bond->deadline && !bond->stretched) {
+			bond->deadline = deadline;
+			bond_schedule(bond);
+		}
+	}
+
+	if (bond->stretched) {
+		/* Late reading done: restart the schedule from now */
+		now = l_time_now();
+		bond->stretched = false;
+		bond->deadline = now +
+			block_get_period(block) * (uint64_t) 1000;
+		bond_schedule(bond);
+
+		if (err == 0)
+			bond_read(bond);
+
+		return;
+	}
+
+	if (bond->missed == 0)
+		return;
+
+	/* Failures don't owe readings */
+	if (err < 0) {
+		bond->missed = 0;
+		return;
+	}
+
+	bond->missed--;
+	bond_read(bond);
+}
+
+/*
+ * Snapshot deadline: next wall clock boundary converted to the monotonic
+ * clock. Converted every cycle: wall clock adjustments are followed.
+ */
+static void snapshot_schedule(struct bond *bond, uint64_t now)
+{
+	uint64_t interval = block_get_interval(bond->block) * (uint64_t) 1000;
+	uint64_t rt = time_realtime();
+
+	if (bond->stamp <= rt)
+		bond->stamp = (rt / interval + 1) * interval;
+
+	bond->deadline = now + (bond->stamp - rt);
+	bond_schedule(bond);
+}
+
+/*
+ * All snapshot members start reading at the same boundary. A reading
+ * still in progress is never caught up: its boundary is already gone.
+ */
+static void snapshot_expired(struct bond *bond, uint64_t now, bool overrun)
+{
+	uint64_t interval = block_get_interval(bond->block) * (uint64_t) 1000;
+
+	snapshot_begin(block_get_snapshot(bond->block), bond->stamp);
+
+	bond->last = bond->deadline;
+	bond->read_stamp = bond->stamp;
+	bond->stamp += interval;
+	snapshot_schedule(bond, now);
+
+	if (overrun) {
+		l_info("block %p: reading in progress", bond->block);
+		return;
+	}
+
+	bond_read(bond);
+}
+
+/*
+ * Deadlines are absolute: the next one is computed from the previous
+ * deadline, never from the reading completion. Reading latency doesn't
+ * drift the schedule.
+ */
+static void polling_to_expired(void *user_data)
+{
+	struct bond *bond = user_data;
+	struct block *block = bond->block;
+	struct load *load = bond->slave->load;
+	uint64_t interval = block_get_period(block) * (uint64_t) 1000;
+	uint64_t now = l_time_now();
+	uint64_t late = (now > bond->deadline ? now - bond->deadline : 0);
+	bool overrun = (bond->req_id != 0);
+
+	/* Triggered: armed only when the reading was over budget */
+	if (bond->triggered) {
+		bond_trigger(bond);
+		return;
+	}
+
+	block_update_timing(block, late > UINT32_MAX ? UINT32_MAX : late,
+			    overrun);
+
+	if (block_get_snapshot(block)) {
+		snapshot_expired(bond, now, overrun);
+		return;
+	}
+
+	/* Link overloaded: lower classes are read less often */
+	load_sample(load, now, overrun);
+	interval *= load_get_factor(load, block_get_priority(block));
+
+	bond->last = bond->deadline;
+	bond->deadline += interval;
+
+	/* Main loop stalled for more than one period */
+	if (bond->deadline <= now && main_opts.overrun == OVERRUN_SKIP)
+		bond->deadline += ((now - bond->deadline) / interval + 1) *
+								interval;
+
+	if (!overrun) {
+		bond_schedule(bond);
+		bond_read(bond);
+		return;
+	}
+
+	/* Slow slave: previous reading is still in progress */
+	l_info("block %p: reading in progress", block);
+
+	switch (main_opts.overrun) {
+	case OVERRUN_CATCHUP:
+		if (bond->missed < CATCHUP_MAX)
+			bond->missed++;
+		bond_schedule(bond);
+		break;
+	case OVERRUN_STRETCH:
+		/* Re-armed once the reading completes */
+		bond->stretched = true;
+		break;
+	case OVERRUN_SKIP:
+	default:
+		bond_schedule(bond);
+		break;
+	}
+}
+
+/* Trigger source removed: the block falls back to its polling interval */
+static bool block_is_triggered(struct slave *slave, struct block *block)
+{
+	struct source_key key;
+
+	key.table = block_get_trigger_table(block);
+	key.address = block_get_trigger(block);
+
+	if (key.address == 0xffff)
+		return false;
+
+	return l_queue_find(slave->source_list, key_cmp, &key) ?
+		true : false;
+}
+
+static void bond_start(struct slave *slave, struct block *block,
+		       uint64_t offset)
+{
+	uint64_t interval = block_get_interval(block) * (uint64_t) 1000;
+	uint64_t now = l_time_now();
+	struct bond *bond;
+
+	bond = l_new(struct bond, 1);
+	bond->block = block;
+	bond->slave = slave;
+	bond->req_id = 0;
+	bond->missed = 0;
+	bond->stretched = false;
+	bond->last = 0;
+	bond->stamp = 0;
+	bond->read_stamp = 0;
+	bond->triggered = block_is_triggered(slave, block);
+
+	timer_init(&bond->timer, polling_to_expired, bond);
+	l_queue_push_tail(slave->bond_list, bond);
+
+	/* First reading: current values, then on trigger changes only */
+	if (bond->triggered) {
+		if (slave->online)
+			bond_read(bond);
+		return;
+	}
+
+	if (block_get_snapshot(block)) {
+		snapshot_schedule(bond, now);
+		return;
+	}
+
+	/* First deadline: next interval multiple plus the phase offset */
+	bond->deadline = (now / interval + 1) * interval + offset;
+	if (bond->deadline >= now + interval)
+		bond->deadline -= interval;
+
+	bond_schedule(bond);
+}
+
+/*
+ * Blocks sharing the same interval are spread evenly across it, shifted
+ * by a per slave offset: slaves sharing the same link or bus don't fire
+ * together either. Offsets are deterministic (url, unit id and plan),
+ * phase aligned blocks start at interval multiples.
+ */
+static void polling_start(struct slave *slave)
+{
+	const struct l_queue_entry *entry;
+	struct l_hashmap *count_map;
+	struct l_hashmap *rank_map;
+	struct block *block;
+	uint32_t seed;
+	uint64_t interval;
+	uint64_t offset;
+	unsigned int count;
+	unsigned int rank;
+	void *key;
+
+	seed = l_str_hash(slave->url) ^ (slave->id * 2654435761U);
+	count_map = l_hashmap_new();
+	rank_map = l_hashmap_new();
+
+	for (entry = l_queue_get_entries(slave->block_list);
+	     entry; entry = entry->next) {
+		block = entry->data;
+		if (block_is_phase_aligned(block) ||
+		    block_get_snapshot(block) ||
+		    block_is_triggered(slave, block))
+			continue;
+
+		key = L_UINT_TO_PTR(block_get_interval(block));
+		count = L_PTR_TO_UINT(l_hashmap_lookup(count_map, key));
+		l_hashmap_replace(count_map, key,
+				  L_UINT_TO_PTR(count + 1), NULL);
+	}
+
+	for (entry = l_queue_get_entries(slave->block_list);
+	     entry; entry = entry->next) {
+		block = entry->data;
+		interval = block_get_interval(block) * (uint64_t) 1000;
+
+		/* Triggered blocks: not polled */
+		if (block_is_triggered(slave, block)) {
+			bond_start(slave, block, 0);
+			continue;
+		}
+
+		/* Zero: polling disabled */
+		if (interval == 0)
+			continue;
+
+		/* Snapshot blocks: wall clock boundaries */
+		if (block_is_phase_aligned(block) || block_get_snapshot(block)) {
+			bond_start(slave, block, 0);
+			continue;
+		}
+
+		key = L_UINT_TO_PTR(block_get_interval(block));
+		count = L_PTR_TO_UINT(l_hashmap_lookup(count_map, key));
+		rank = L_PTR_TO_UINT(l_hashmap_lookup(rank_map, key));
+		l_hashmap_replace(rank_map, key,
+				  L_UINT_TO_PTR(rank + 1), NULL);
+
+		offset = (seed % interval + rank * interval / count) %
+								interval;
+		bond_start(slave, block, offset);
+	}
+
+	l_hashmap_destroy(count_map, NULL);
+	l_hashmap_destroy(rank_map, NULL);
+}
+
+static void bond_pause(void *data, void *user_data)
+{
+	struct bond *bond = data;
+	struct slave *slave = bond->slave;
+
+	if (bond->req_id)
+		slave->drv->cancel(slave->ctx, bond->req_id);
+
+	bond->req_id = 0;
+	bond->missed = 0;
+	bond->stretched = false;
+	timer_cancel(&bond->timer);
+}
+
+/* Same phase as before the disconnection: whole periods are skipped */
+static void bond_resume(void *data, void *user_data)
+{
+	struct bond *bond = data;
+	uint64_t interval = block_get_period(bond->block) * (uint64_t) 1000;
+	uint64_t now = l_time_now();
+
+	if (bond->triggered) {
+		bond_read(bond);
+		return;
+	}
+
+	if (block_get_snapshot(bond->block)) {
+		snapshot_schedule(bond, now);
+		return;
+	}
+
+	/* Zero: polling disabled */
+	if (interval == 0)
+		return;
+
+	if (bond->deadline <= now)
+		bond->deadline += ((now - bond->deadline) / interval + 1) *
+								interval;
+
+	bond_schedule(bond);
+}
+
+/*
+ * Link down: only the transport is torn down. Bonds, phase offsets and
+ * adaptive periods are kept and resumed once connected again.
+ */
+static void polling_pause(struct slave *slave)
+{
+	l_queue_foreach(slave->bond_list, bond_pause, NULL);
+}
+
+static void polling_resume(struct slave *slave)
+{
+	l_queue_foreach(slave->bond_list, bond_resume, NULL);
+}
+
+static void polling_stop(struct slave *slave)
+{
+	l_queue_destroy(slave->bond_list, bond_destroy);
+	slave->bond_list = l_queue_new();
+}
+
+/* Image covers the planned blocks: sources become views into it */
+static void image_plan(struct slave *slave)
+{
+	const struct l_queue_entry *entry;
+	struct block *block;
+	uint32_t first[MODBUS_TABLE_MAX];
+	uint32_t end[MODBUS_TABLE_MAX];
+	uint32_t last;
+	int i;
+
+	for (i = 0; i < MODBUS_TABLE_MAX; i++) {
+		first[i] = UINT32_MAX;
+		end[i] = 0;
+	}
+
+	for (entry = l_queue_get_entries(slave->block_list);
+	     entry; entry = entry->next) {
+		block = entry->data;
+		i = block_get_table(block);
+		last = block_get_address(block) + block_get_size(block);
+
+		if (block_get_address(block) < first[i])
+			first[i] = block_get_address(block);
+		if (last > end[i])
+			end[i] = last;
+	}
+
+	for (i = 0; i < MODBUS_TABLE_MAX; i++) {
+		if (first[i] == UINT32_MAX)
+			image_resize(slave->image, i, 0, 0);
+		else
+			image_resize(slave->image, i, first[i],
+				     end[i] - first[i]);
+	}
+
+	for (entry = l_queue_get_entries(slave->source_list);
+	     entry; entry = entry->next)
+		source_set_image(entry->data, slave->image);
+}
+
+static void slave_plan(struct slave *slave)
+{
+	/* Bonds reference blocks: release them first */
+	polling_stop(slave);
+
+	l_queue_destroy(slave->block_list, block_destroy);
+	slave->block_list = block_plan(slave->source_list,
+				       main_opts.block_gap, slave->limits);
+	image_plan(slave);
+
+	/* Armed only while online */
+	polling_start(slave);
+}
+
+static void replan_cb(struct l_idle *idle, void *user_data)
+{
+	struct slave *slave = user_data;
+
+	l_idle_remove(idle);
+	slave->replan = NULL;
+
+	slave_plan(slave);
+}
+
+static void slave_replan(struct slave *slave)
+{
+	if (slave->replan)
+		return;
+
+	slave->replan = l_idle_create(replan_cb, slave, NULL);
+}
+
+static void hole_probe_destroy(void *user_data)
+{
+	struct hole_probe *probe = user_data;
+
+	if (probe->slave)
+		l_queue_remove(probe->slave->hole_list, probe);
+
+	l_free(probe->buffer);
+	l_free(probe);
+}
+
+static void hole_probe_cb(int err, void *user_data)
+{
+	struct hole_probe *probe = user_data;
+	struct slave *slave = probe->slave;
+
+	if (!slave)
+		return;
+
+	/* Exception on the range alone: unmapped */
+	if (err == -EFAULT) {
+		devlimits_confirm_hole(slave->limits, probe->table,
+				       probe->first, probe->last);
+		return;
+	}
+
+	/*
+	 * Readable: the quantity was rejected instead. Other failures
+	 * don't confirm it either: merged again, faults are learned anew.
+	 */
+	devlimits_remove_hole(slave->limits, probe->table,
+			      probe->first, probe->last);
+	if (err == 0)
+		devlimits_shrink(slave->limits, probe->table, probe->max);
+
+	slave_replan(slave);
+}
+
+/* Gap of a faulty block: split now, persisted if reading it faults */
+static void hole_probe_start(int table, uint16_t first, uint16_t last,
+			     void *user_data)
+{
+	struct gap_search *search = user_data;
+	struct slave *slave = search->slave;
+	struct hole_probe *hole;
+	uint16_t nb = last - first + 1;
+
+	if (!devlimits_add_hole(slave->limits, table, first, last))
+		return;
+
+	hole = l_new(struct hole_probe, 1);
+	hole->slave = slave;
+	hole->table = table;
+	hole->first = first;
+	hole->last = last;
+	hole->max = search->max;
+
+	if (MODBUS_TABLE_IS_BITS(table)) {
+		hole->buffer = l_new(uint8_t, (nb + 7) / 8);
+		hole->id = slave->drv->read_bits(slave->ctx, table, first,
+					nb, MODBUS_PRIORITY_BACKGROUND,
+					hole->buffer, hole_probe_cb,
+					hole, hole_probe_destroy);
+	} else {
+		hole->buffer = l_new(uint16_t, nb);
+		hole->id = slave->drv->read_registers(slave->ctx, table,
+					first, nb, MODBUS_PRIORITY_BACKGROUND,
+					hole->buffer, hole_probe_cb,
+					hole, hole_probe_destroy);
+	}
+
+	/* Not sent: the range is merged again on the next plan */
+	if (!hole->id) {
+		devlimits_remove_hole(slave->limits, table, first, last);
+		l_free(hole->buffer);
+		l_free(hole);
+		return;
+	}
+
+	l_queue_push_tail(slave->hole_list, hole);
+	search->found = true;
+}
+
+/*
+ * Learn the device limits from block readings: exceptions and timeouts
+ * of merged blocks split them. Planning releases the bonds: deferred,
+ * since it can't run from a reading callback.
+ */
+static void learn_limits(struct slave *slave, struct block *block, int err)
+{
+	const struct l_queue_entry *entry;
+	struct gap_search search;
+	int table = block_get_table(block);
+	uint16_t size = block_get_size(block);
+	uint16_t ok = slave->max_ok[table];
+	uint16_t max = size / 2;
+	bool learned = false;
+
+	if (err == 0) {
+		if (size > ok)
+			slave->max_ok[table] = size;
+		return;
+	}
+
+	/* A single source can't be split */
+	entry = l_queue_get_entries(block_get_source_list(block));
+	if (!entry || !entry->next)
+		return;
+
+	switch (err) {
+	case -EFAULT:
+		/* Illegal data address: unmapped gaps or too many items */
+		search.slave = slave;
+		search.max = max;
+		search.found = false;
+		block_foreach_gap(block, hole_probe_start, &search);
+
+		learned = search.found;
+		if (!learned)
+			learned = devlimits_shrink(slave->limits, table, max);
+		break;
+	case -EINVAL:
+		/* Illegal data value: quantity not supported */
+		learned = devlimits_shrink(slave->limits, table, max);
+		break;
+	case -ETIMEDOUT:
+		/* Smaller readings succeed: large ones may be dropped */
+		if (ok > 0 && size > ok)
+			learned = devlimits_shrink(slave->limits, table,
+						max > ok ? max : ok);
+		break;
+	default:
+		break;
+	}
+
+	if (learned)
+		slave_replan(slave);
+}
+
+static void load_changed(void *user_data)
+{
+	struct slave *slave = user_data;
+
+	l_dbus_property_changed(dbus_get_bus(), slave->path,
+				SLAVE_IFACE, "Degraded");
+}
+
+/*
+ * Exponential backoff with jitter: the delay doubles on each failure up
+ * to the configured cap and is picked between half and the full value.
+ */
+static void retry_schedule(struct slave *slave)
+{
+	uint64_t delay = main_opts.retry_min * (uint64_t) 1000;
+	uint64_t max = main_opts.retry_max * (uint64_t) 1000;
+
+	delay <<= (slave->retries < 20 ? slave->retries : 20);
+	if (delay > max)
+		delay = max;
+
+	delay = delay / 2 + l_getrandom_uint32() % (delay / 2 + 1);
+
+	slave->retries++;
+	slave->retry_delay = delay;
+	l_timeout_modify_ms(slave->poll_to, delay);
+
+	l_dbus_property_changed(dbus_get_bus(), slave->path,
+				SLAVE_IFACE, "RetryDelay");
+}
+
+static void retry_reset(struct slave *slave)
+{
+	if (slave->retries == 0)
+		return;
+
+	slave->retries = 0;
+	slave->retry_delay = 0;
+
+	l_dbus_property_changed(dbus_get_bus(), slave->path,
+				SLAVE_IFACE, "RetryDelay");
+}
+
+static void breaker_open(struct slave *slave)
+{
+	l_info("slave %p: %u timeouts, circuit open", slave, slave->timeouts);
+
+	slave->breaker = true;
+	l_dbus_property_changed(dbus_get_bus(), slave->path,
+				SLAVE_IFACE, "CircuitOpen");
 
-	slave_free(slave);
+	/* Probe: call enable_slave */
+	retry_schedule(slave);
 }
 
-static void create_slave_from_storage(const char *key,
-				int slave_id,
-				const char *name,
-				const char *url,
-				void *user_data)
+static void breaker_close(struct slave *slave)
 {
-	struct l_queue *list = user_data;
-	struct slave *slave;
+	l_info("slave %p: circuit closed", slave);
 
-	slave = slave_create(key, slave_id, name, url);
-	if (!slave)
-		return;
+	slave->breaker = false;
+	slave->timeouts = 0;
+	retry_reset(slave);
 
-	l_queue_push_head(list, slave);
+	l_dbus_property_changed(dbus_get_bus(), slave->path,
+				SLAVE_IFACE, "CircuitOpen");
 }
 
-static void create_source_from_storage(const char *address,
-				const char *name,
-				const char *type,
-				const char *unit,
-				int interval,
-				void *user_data)
+static void probe_cb(int err, void *user_data)
 {
 	struct slave *slave = user_data;
-	struct source *source;
-	unsigned int uaddr;
 
-	if (sscanf(address, "0x%04x", &uaddr) != 1)
-		return;
+	slave->probe_id = 0;
 
-	source = source_create(slave->path, name, type, unit, uaddr,
-			       interval, slave->src_storage, false);
-	if (!source)
+	/* Disconnected: reconnection handles the retries */
+	if (err == -ECONNRESET)
 		return;
 
-	l_queue_push_head(slave->source_list, source);
+	if (err == 0 || err == -EFAULT || err == -EINVAL)
+		breaker_close(slave);
+	else
+		retry_schedule(slave);
 }
 
-static void destroy_handler(void *user_data)
+/* Cheapest reading: one bit or register of the first block */
+static void breaker_probe(struct slave *slave)
 {
-	struct slave *slave = user_data;
+	struct block *block = l_queue_peek_head(slave->block_list);
+
+	if (slave->probe_id)
+		return;
+
+	if (!block) {
+		breaker_close(slave);
+		return;
+	}
 
-	/* Try to connect again after 5 seconds: call enable_slave */
-	l_timeout_modify(slave->poll_to, 5);
+	if (block_is_bits(block))
+		slave->probe_id = slave->drv->read_bits(slave->ctx,
+					block_get_table(block),
+					block_get_address(block), 1,
+					MODBUS_PRIORITY_NORMAL,
+					(uint8_t *) &slave->probe,
+					probe_cb, slave, NULL);
+	else
+		slave->probe_id = slave->drv->read_registers(slave->ctx,
+					block_get_table(block),
+					block_get_address(block), 1,
+					MODBUS_PRIORITY_NORMAL,
+					&slave->probe,
+					probe_cb, slave, NULL);
+
+	if (!slave->probe_id)
+		retry_schedule(slave);
 }
 
-static void disconnected_cb(struct l_io *io, void *user_data)
+static void disconnected_cb(int err, void *user_data)
 {
 	struct slave *slave = user_data;
-	struct modbus_driver *driver = slave->drv;
 
 	l_info("slave %p disconnected", slave);
 
-	l_hashmap_destroy(slave->to_list, timeout_destroy);
-	slave->to_list = l_hashmap_string_new();
-
-	driver->destroy(slave->modbus);
-	slave->modbus = NULL;
+	slave->online = false;
 
-	l_io_destroy(slave->io);
-	slave->io = NULL;
+	polling_pause(slave);
 
 	l_dbus_property_changed(dbus_get_bus(), slave->path,
 				SLAVE_IFACE, "Online");
+
+	/* Try to connect again: call enable_slave */
+	retry_schedule(slave);
 }
 
-static void polling_to_expired(struct l_timeout *timeout, void *user_data)
+static void connect_cb(int err, void *user_data)
 {
-	struct bond *bond = user_data;
-	struct source *source = bond->source;
-	struct slave *slave = bond->slave;
-	struct modbus_driver *driver = slave->drv;
-	const char *sig = source_get_signature(source);
-	uint16_t u16_addr = source_get_address(source);
-	bool val_bool;
-	uint8_t val_u8 = 0;
-	uint16_t val_u16 = 0;
-	uint32_t val_u32 = 0;
-	uint64_t val_u64 = 0;
-	int ret = 0, err;
-
-	l_info("modbus reading source %p addr:(0x%x)", source, u16_addr);
-
-	switch (sig[0]) {
-	case 'b':
-		ret = driver->read_bool(slave->modbus, u16_addr, &val_bool);
-		if (ret != -1)
-			source_set_value_bool(source, val_bool);
-		break;
-	case 'y':
-		ret = driver->read_byte(slave->modbus, u16_addr, &val_u8);
-		if (ret != -1)
-			source_set_value_byte(source, val_u8);
+	struct slave *slave = user_data;
 
-		break;
-	case 'q':
-		ret = driver->read_u16(slave->modbus, u16_addr, &val_u16);
-		if (ret != -1)
-			source_set_value_u16(source, val_u16);
-		break;
-	case 'u':
-		/* Assuming network order */
-		ret = driver->read_u32(slave->modbus, u16_addr, &val_u32);
-		if (ret != -1)
-			source_set_value_u32(source, L_BE32_TO_CPU(val_u32));
-		break;
-	case 't':
-		/* Assuming network order */
-		ret = driver->read_u64(slave->modbus, u16_addr, &val_u64);
-		if (ret != -1)
-			source_set_value_u64(source, L_BE64_TO_CPU(val_u64));
-		break;
-	default:
-		break;
-	}
+	/* Attempt completed: next slave waiting may connect */
+	ramp_release(slave->ramp);
+	slave->ramp = NULL;
 
-	if (ret == -1) {
-		err = errno;
-		l_error("read(%x): %s(%d)", u16_addr, strerror(err), err);
+	if (err < 0) {
+		retry_schedule(slave);
+		return;
 	}
 
-	l_timeout_modify_ms(timeout, source_get_interval(source));
+	slave->online = true;
+	retry_reset(slave);
+
+	/* Circuit still open: probe before reading */
+	if (slave->breaker)
+		retry_schedule(slave);
+
+	polling_resume(slave);
+
+	l_dbus_property_changed(dbus_get_bus(), slave->path,
+				SLAVE_IFACE, "Online");
 }
 
-static void polling_start(void *data, void *user_data)
+static void slave_admitted(void *user_data)
 {
 	struct slave *slave = user_data;
-	struct source *source = data;
-	struct l_timeout *timeout;
-	struct bond *bond;
+	int err;
 
-	/* timeout exists? */
-	timeout = l_hashmap_lookup(slave->to_list, source_get_path(source));
-	if (timeout) {
-		l_timeout_modify_ms(timeout, source_get_interval(source));
-		return;
+	err = slave->drv->connect(slave->ctx, connect_cb, slave);
+	if (err < 0 && err != -EALREADY) {
+		l_error("connect(%s): %s(%d)", slave->url,
+			strerror(-err), -err);
+		ramp_release(slave->ramp);
+		slave->ramp = NULL;
+		retry_schedule(slave);
 	}
+}
 
-	/* New timeout */
-	bond = l_new(struct bond, 1);
-	bond->source = source;
-	bond->slave = slave;
+/* Connection ramp-up order: highest class among the sources */
+static int slave_priority(struct slave *slave)
+{
+	const struct l_queue_entry *entry;
+	int prio = MODBUS_PRIORITY_BACKGROUND;
 
-	timeout = l_timeout_create_ms(source_get_interval(source),
-				      polling_to_expired, bond, l_free);
+	for (entry = l_queue_get_entries(slave->source_list);
+	     entry; entry = entry->next)
+		if (source_get_priority(entry->data) < prio)
+			prio = source_get_priority(entry->data);
 
-	l_hashmap_insert(slave->to_list, source_get_path(source), timeout);
+	return prio;
 }
 
 static void enable_slave(struct l_timeout *timeout, void *user_data)
 {
 	struct slave *slave = user_data;
-	struct modbus_driver *driver = slave->drv;
-	int err;
 
 	/* Already connected ? */
-	if (slave->modbus)
+	if (slave->online) {
+		if (slave->breaker)
+			breaker_probe(slave);
 		return;
-
-	slave->modbus = driver->create(slave->url);
-	if (!slave->modbus) {
-		/* FIXME: URL may be invalid. How to handle this scenario? */
-		l_error("Can not create modbus slave: %s", slave->url);
-		goto retry;
-	}
-
-	if (modbus_set_slave(slave->modbus, slave->id) < 0) {
-		l_error("Can not set slave id: %d (url: %s)",
-			slave->id, slave->url);
-		goto error;
 	}
 
-	if (modbus_connect(slave->modbus) != -1) {
-		slave->io = l_io_new(modbus_get_socket(slave->modbus));
-		if (slave->io == NULL)
-			goto error;
-
-		l_io_set_disconnect_handler(slave->io, disconnected_cb,
-					    slave, destroy_handler);
-
-		l_queue_foreach(slave->source_list,
-				polling_start, slave);
-
-		l_dbus_property_changed(dbus_get_bus(), slave->path,
-					SLAVE_IFACE, "Online");
-
+	/* Waiting for a connection slot */
+	if (slave->ramp)
 		return;
-	}
-
-error:
-	/* Releasing connection */
-	err = errno;
-
-	l_info("connect(%p): %s(%d)", slave->modbus, strerror(err), err);
-
-	driver->destroy(slave->modbus);
-
-	slave->modbus = NULL;
 
-retry:
-	/* Try again in 5 seconds */
-	l_timeout_modify(timeout, 5);
+	slave->ramp = ramp_request(slave_priority(slave),
+				   slave_admitted, slave);
 }
 
 static struct l_dbus_message *method_source_add(struct l_dbus *dbus,
@@ -357,6 +1333,7 @@ static struct l_dbus_message *method_source_add(struct l_dbus *dbus,
 						void *user_data)
 {
 	struct slave *slave = user_data;
+	const struct l_queue_entry *entry;
 	struct source *source;
 	struct l_dbus_message *reply;
 	struct l_dbus_message_builder *builder;
@@ -370,6 +1347,17 @@ static struct l_dbus_message *method_source_add(struct l_dbus *dbus,
 	char *unithex;
 	uint16_t address = 0xffff;
 	uint16_t interval = 1000; /* ms */
+	uint16_t max_interval = 0; /* Adaptive polling disabled */
+	const char *priority = NULL;
+	const char *snapshot = NULL;
+	const char *table_str = NULL;
+	const char *trigger_str = NULL;
+	struct source_key trigger_key;
+	int table;
+	uint16_t trigger = 0xffff; /* Polled: no trigger */
+	uint64_t mask = 0;
+	int prio = MODBUS_PRIORITY_NORMAL;
+	bool aligned = false;
 	bool ret;
 
 	if (!l_dbus_message_get_arguments(msg, "a{sv}", &dict))
@@ -392,9 +1380,37 @@ static struct l_dbus_message *method_source_add(struct l_dbus *dbus,
 		else if (strcmp(key, "Address") == 0)
 			ret = l_dbus_message_iter_get_variant(&value,
 							      "q", &address);
+		/* Address space: coils, discrete inputs, input or holding */
+		else if (strcmp(key, "Table") == 0)
+			ret = l_dbus_message_iter_get_variant(&value,
+							      "s", &table_str);
 		else if (strcmp(key, "PollingInterval") == 0)
 			ret = l_dbus_message_iter_get_variant(&value,
 							      "q", &interval);
+		else if (strcmp(key, "MaxPollingInterval") == 0)
+			ret = l_dbus_message_iter_get_variant(&value,
+							      "q", &max_interval);
+		else if (strcmp(key, "PhaseAligned") == 0)
+			ret = l_dbus_message_iter_get_variant(&value,
+							      "b", &aligned);
+		/* Request class: critical, normal or background */
+		else if (strcmp(key, "Priority") == 0)
+			ret = l_dbus_message_iter_get_variant(&value,
+							      "s", &priority);
+		/* Wall clock aligned group read as a whole */
+		else if (strcmp(key, "Snapshot") == 0)
+			ret = l_dbus_message_iter_get_variant(&value,
+							      "s", &snapshot);
+		/* Read when the source at this address changes */
+		else if (strcmp(key, "Trigger") == 0)
+			ret = l_dbus_message_iter_get_variant(&value,
+							      "q", &trigger);
+		else if (strcmp(key, "TriggerTable") == 0)
+			ret = l_dbus_message_iter_get_variant(&value,
+							      "s", &trigger_str);
+		else if (strcmp(key, "TriggerMask") == 0)
+			ret = l_dbus_message_iter_get_variant(&value,
+							      "t", &mask);
 		else
 			return dbus_error_invalid_args(msg);
 
@@ -419,18 +1435,63 @@ static struct l_dbus_message *method_source_add(struct l_dbus *dbus,
 		return dbus_error_invalid_args(msg);
 	}
 
-	source = l_queue_find(slave->source_list,
-			      address_cmp, L_INT_TO_PTR(address));
-	if (source) {
-		l_error("source: address assigned already");
+	if (priority) {
+		prio = source_priority_from_string(priority);
+		if (prio < 0)
+			return dbus_error_invalid_args(msg);
+	}
+
+	/* Default: discrete inputs for bits, holding registers otherwise */
+	table = (table_str ? source_table_from_string(table_str) :
+		 source_table_default(signature));
+	if (!source_table_is_valid(table, signature))
+		return dbus_error_invalid_args(msg);
+
+	if (snapshot && !snapshot_name_is_valid(snapshot))
 		return dbus_error_invalid_args(msg);
+
+	/* Trigger: another source of this slave, not a snapshot member */
+	trigger_key.table = table;
+	trigger_key.address = trigger;
+	if (trigger != 0xffff) {
+		trigger_key.table = (trigger_str ?
+				     source_table_from_string(trigger_str) :
+				     trigger_table_default(slave, trigger));
+
+		if (snapshot || (trigger_key.table == table &&
+				 trigger == address) ||
+		    !l_queue_find(slave->source_list, key_cmp, &trigger_key))
+			return dbus_error_invalid_args(msg);
+	}
+
+	/* Discrete inputs and holding registers share storage groups */
+	for (entry = l_queue_get_entries(slave->source_list);
+	     entry; entry = entry->next) {
+		if (source_has_key(entry->data, table, address)) {
+			l_error("source: address assigned already");
+			return dbus_error_invalid_args(msg);
+		}
 	}
 
-	source = source_create(slave->path, name, type, unit, address, interval,
-			       slave->src_storage, true);
+	source = source_create(slave->path, name, type, unit, table, address,
+			       interval, slave->src_storage, true);
 	if (!source)
 		return dbus_error_invalid_args(msg);
 
+	source_set_max_interval(source, max_interval, true);
+	source_set_phase_aligned(source, aligned, true);
+	source_set_priority(source, prio, true);
+
+	/* Members share the polling interval of the group */
+	if (snapshot && snapshot_add(snapshot, source) < 0) {
+		source_destroy(source, true);
+		return dbus_error_invalid_args(msg);
+	}
+
+	source_set_snapshot(source, snapshot, true);
+	source_set_trigger(source, trigger_key.table, trigger, mask, true);
+	source_set_changed_func(source, source_changed, slave);
+
 	/* Add object path to reply message */
 	reply = l_dbus_message_new_method_return(msg);
 	builder = l_dbus_message_builder_new(reply);
@@ -441,8 +1502,7 @@ static struct l_dbus_message *method_source_add(struct l_dbus *dbus,
 
 	l_queue_push_head(slave->source_list, source);
 
-	if (slave->io)
-		polling_start(source, slave);
+	slave_plan(slave);
 
 	return reply;
 }
@@ -462,6 +1522,11 @@ static struct l_dbus_message *method_source_remove(struct l_dbus *dbus,
 	if (unlikely(!source))
 		return dbus_error_invalid_args(msg);
 
+	snapshot_remove(source_get_snapshot(source), source);
+
+	/* Blocks reference sources: re-plan before releasing it */
+	slave_plan(slave);
+
 	/* Remove from storage */
 	source_destroy(source, true);
 
@@ -536,15 +1601,183 @@ static bool property_get_online(struct l_dbus *dbus,
 				  void *user_data)
 {
 	struct slave *slave = user_data;
-	bool online;
 
-	online = (slave->modbus ? true : false);
+	l_dbus_message_builder_append_basic(builder, 'b', &slave->online);
+
+	return true;
+}
+
+static bool property_get_retry_delay(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct slave *slave = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'u', &slave->retry_delay);
+
+	return true;
+}
+
+static bool property_get_circuit_open(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct slave *slave = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'b', &slave->breaker);
+
+	return true;
+}
+
+static bool property_get_timeout(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct slave *slave = user_data;
+	uint32_t timeout = slave->drv->get_timeout(slave->ctx);
+
+	l_dbus_message_builder_append_basic(builder, 'u', &timeout);
+
+	return true;
+}
+
+static struct l_dbus_message *property_set_timeout(struct l_dbus *dbus,
+					 struct l_dbus_message *msg,
+					 struct l_dbus_message_iter *new_value,
+					 l_dbus_property_complete_cb_t complete,
+					 void *user_data)
+{
+	struct slave *slave = user_data;
+	uint32_t timeout;
+
+	/* Zero: derived from the round-trip time */
+	if (!l_dbus_message_iter_get_variant(new_value, "u", &timeout))
+		return dbus_error_invalid_args(msg);
+
+	slave->drv->set_timeout(slave->ctx, timeout);
+
+	complete(dbus, msg, NULL);
+
+	storage_write_key_int(slaves_storage, slave->key,
+			      "ResponseTimeout", timeout);
+
+	return NULL;
+}
+
+static bool property_get_rtt(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct slave *slave = user_data;
+	uint32_t rtt = slave->drv->get_rtt(slave->ctx);
+
+	l_dbus_message_builder_append_basic(builder, 'u', &rtt);
+
+	return true;
+}
+
+/* Queueing delay per request class at the link or bus of the slave */
+static bool property_get_queue_delay(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct slave *slave = user_data;
+	uint32_t delay;
+	int prio;
+
+	l_dbus_message_builder_enter_array(builder, "{su}");
+
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++) {
+		delay = slave->drv->queue_delay(slave->ctx, prio);
+
+		l_dbus_message_builder_enter_dict(builder, "su");
+		l_dbus_message_builder_append_basic(builder, 's',
+					source_priority_to_string(prio));
+		l_dbus_message_builder_append_basic(builder, 'u', &delay);
+		l_dbus_message_builder_leave_dict(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+
+	return true;
+}
+
+/* Sources read less often than configured: link overloaded */
+static bool property_get_degraded(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct slave *slave = user_data;
+	const struct l_queue_entry *entry;
+	struct source *source;
+
+	l_dbus_message_builder_enter_array(builder, "o");
+
+	for (entry = l_queue_get_entries(slave->source_list);
+	     entry; entry = entry->next) {
+		source = entry->data;
+		if (load_get_factor(slave->load,
+				    source_get_priority(source)) == 1)
+			continue;
+
+		l_dbus_message_builder_append_basic(builder, 'o',
+						source_get_path(source));
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+
+	return true;
+}
+
+static bool request_rate_get(struct slave *slave,
+			     struct l_dbus_message_builder *builder, bool peak)
+{
+	uint64_t now = l_time_now();
+	uint32_t rate;
+	int i;
+
+	l_dbus_message_builder_enter_array(builder, "{su}");
 
-	l_dbus_message_builder_append_basic(builder, 'b', &online);
+	for (i = 0; i < BUDGET_MAX; i++) {
+		rate = (peak ? bucket_get_peak(slave->bucket[i]) :
+			bucket_get_rate(slave->bucket[i], now));
+
+		l_dbus_message_builder_enter_dict(builder, "su");
+		l_dbus_message_builder_append_basic(builder, 's',
+						    budget_str[i]);
+		l_dbus_message_builder_append_basic(builder, 'u', &rate);
+		l_dbus_message_builder_leave_dict(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
 
 	return true;
 }
 
+/* Requests sent during the last second: slave, link and global */
+static bool property_get_request_rate(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	return request_rate_get(user_data, builder, false);
+}
+
+/* Highest amount of requests sent in one second */
+static bool property_get_request_peak(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	return request_rate_get(user_data, builder, true);
+}
+
 static void setup_interface(struct l_dbus_interface *interface)
 {
 
@@ -579,6 +1812,52 @@ static void setup_interface(struct l_dbus_interface *interface)
 				       NULL))
 		l_error("Can't add 'Online' property");
 
+	/* Reconnection or probe backoff in ms: 0 if not retrying */
+	if (!l_dbus_interface_property(interface, "RetryDelay", 0, "u",
+				       property_get_retry_delay,
+				       NULL))
+		l_error("Can't add 'RetryDelay' property");
+
+	/* Circuit breaker: readings suspended after repeated timeouts */
+	if (!l_dbus_interface_property(interface, "CircuitOpen", 0, "b",
+				       property_get_circuit_open,
+				       NULL))
+		l_error("Can't add 'CircuitOpen' property");
+
+	/* Response timeout in ms: writing a non-zero value fixes it */
+	if (!l_dbus_interface_property(interface, "ResponseTimeout", 0, "u",
+				       property_get_timeout,
+				       property_set_timeout))
+		l_error("Can't add 'ResponseTimeout' property");
+
+	/* Smoothed round-trip time in microseconds */
+	if (!l_dbus_interface_property(interface, "RoundTripTime", 0, "u",
+				       property_get_rtt,
+				       NULL))
+		l_error("Can't add 'RoundTripTime' property");
+
+	/* Queueing delay average in microseconds per request class */
+	if (!l_dbus_interface_property(interface, "QueueDelay", 0, "a{su}",
+				       property_get_queue_delay,
+				       NULL))
+		l_error("Can't add 'QueueDelay' property");
+
+	/* Sources stretched by load shedding */
+	if (!l_dbus_interface_property(interface, "Degraded", 0, "ao",
+				       property_get_degraded,
+				       NULL))
+		l_error("Can't add 'Degraded' property");
+
+	if (!l_dbus_interface_property(interface, "RequestRate", 0, "a{su}",
+				       property_get_request_rate,
+				       NULL))
+		l_error("Can't add 'RequestRate' property");
+
+	if (!l_dbus_interface_property(interface, "PeakRequestRate", 0,
+				       "a{su}", property_get_request_peak,
+				       NULL))
+		l_error("Can't add 'PeakRequestRate' property");
+
 }
 
 struct slave *slave_create(const char *key, uint8_t id,
@@ -589,6 +1868,7 @@ struct slave *slave_create(const char *key, uint8_t id,
 	struct stat st;
 	char *dpath;
 	char *filename;
+	int timeout = 0;
 	int st_ret;
 
 	/* "tcp://host:port or serial://dev/ttyUSB0, ... "*/
@@ -615,11 +1895,46 @@ struct slave *slave_create(const char *key, uint8_t id,
 	slave->id = id;
 	slave->name = l_strdup(name);
 	slave->url = l_strdup(url);
-	slave->modbus = NULL;
-	slave->io = NULL;
+	slave->online = false;
+	slave->retries = 0;
+	slave->retry_delay = 0;
+	slave->timeouts = 0;
+	slave->breaker = false;
+	slave->probe_id = 0;
 	slave->source_list = l_queue_new();
-	slave->to_list = l_hashmap_string_new();
+	slave->block_list = l_queue_new();
+	slave->bond_list = l_queue_new();
+	slave->hole_list = l_queue_new();
 	slave->drv = drv;
+	slave->ctx = drv->create(url, id, disconnected_cb, slave);
+	if (!slave->ctx) {
+		/* FIXME: URL may be invalid. How to handle this scenario? */
+		l_error("Can not create modbus slave: %s", url);
+		l_queue_destroy(slave->hole_list, NULL);
+		l_queue_destroy(slave->bond_list, NULL);
+		l_queue_destroy(slave->block_list, NULL);
+		l_queue_destroy(slave->source_list, NULL);
+		l_free(slave->url);
+		l_free(slave->name);
+		l_free(slave->key);
+		l_free(slave);
+		l_free(dpath);
+		return NULL;
+	}
+
+	/* Slaves sharing the url share the link (or bus) budget */
+	filename = l_strdup_printf("link:%s", url);
+	slave->bucket[BUDGET_SLAVE] = bucket_new(NULL, main_opts.slave_rate);
+	slave->bucket[BUDGET_LINK] = bucket_new(filename, main_opts.link_rate);
+	slave->bucket[BUDGET_GLOBAL] = bucket_new("global",
+						  main_opts.global_rate);
+	slave->load = load_get(filename, load_changed, slave);
+	l_free(filename);
+
+	/* Response timeout override */
+	if (storage_read_key_int(slaves_storage, key, "ResponseTimeout",
+				 &timeout) > 0 && timeout > 0)
+		drv->set_timeout(slave->ctx, timeout);
 
 	filename = l_strdup_printf("%s/%s/sources.conf",
 				   STORAGEDIR, slave->key);
@@ -630,6 +1945,13 @@ struct slave *slave_create(const char *key, uint8_t id,
 	slave->src_storage = storage_open(filename);
 	l_free(filename);
 
+	filename = l_strdup_printf("%s/%s/device.conf",
+				   STORAGEDIR, slave->key);
+	slave->limits = devlimits_new(filename);
+	l_free(filename);
+
+	slave->image = image_new();
+
 	if (!l_dbus_register_object(dbus_get_bus(),
 				    dpath,
 				    slave_ref(slave),
@@ -660,6 +1982,8 @@ struct slave *slave_create(const char *key, uint8_t id,
 					 "URL", url);
 	}
 
+	slave_plan(slave);
+
 	slave->poll_to = l_timeout_create(1, enable_slave, slave, NULL);
 
 	return slave_ref(slave);
@@ -675,9 +1999,6 @@ void slave_destroy(struct slave *slave, bool rm)
 	if (unlikely(!slave))
 		return;
 
-	if (slave->io)
-		l_io_set_disconnect_handler(slave->io, NULL, NULL, NULL);
-
 	l_dbus_unregister_object(dbus_get_bus(), slave->path);
 
 	if (!rm)
@@ -693,6 +2014,16 @@ void slave_destroy(struct slave *slave, bool rm)
 
 	l_free(filename);
 
+	/* Remove stored data: device.conf */
+	filename = l_strdup_printf("%s/%s/device.conf",
+				   STORAGEDIR, slave->key);
+	if (unlink(filename) == -1) {
+		err = errno;
+		l_error("unlink(%s): %s(%d)", filename, strerror(err), err);
+	}
+
+	l_free(filename);
+
 	/* Remove stored data: directory */
 	filename = l_strdup_printf("%s/%s", STORAGEDIR, slave->key);
 	if (rmdir(filename) == -1) {
@@ -725,6 +2056,21 @@ struct l_queue *slave_start(const char *units_filename)
 
 	l_info("Starting slave ...");
 
+	if (timer_start() < 0) {
+		l_error("Can not start timer!");
+		return NULL;
+	}
+
+	if (ramp_start(main_opts.connect_max, main_opts.connect_rate) < 0) {
+		l_error("Can not start connection ramp!");
+		return NULL;
+	}
+
+	if (worker_start(main_opts.workers) < 0) {
+		l_error("Can not start workers!");
+		return NULL;
+	}
+
 	/* Slave settings file */
 	slaves_storage = storage_open(filename);
 	if (slaves_storage < 0) {
@@ -746,6 +2092,7 @@ struct l_queue *slave_start(const char *units_filename)
 		l_error("dbus: unable to register %s", SLAVE_IFACE);
 
 	source_start();
+	snapshot_start();
 
 	list = l_queue_new();
 	storage_foreach_slave(slaves_storage, create_slave_from_storage, list);
@@ -755,10 +2102,14 @@ struct l_queue *slave_start(const char *units_filename)
 
 void slave_stop(void)
 {
+	worker_stop();
+	timer_stop();
+	ramp_stop();
 
 	storage_close(units_storage);
 	storage_close(slaves_storage);
 
+	snapshot_stop();
 	source_stop();
 
 	l_dbus_unregister_interface(dbus_get_bus(),
@@ -0,0 +1,424 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <ell/ell.h>
+
+#include "dbus.h"
+#include "source.h"
+#include "snapshot.h"
+
+struct member {
+	struct source *source;
+	uint64_t value;			/* Value read for the boundary */
+	uint64_t published;		/* Value of the last snapshot */
+	bool done;			/* Read for the current boundary */
+};
+
+struct snapshot {
+	char *name;
+	char *path;			/* D-Bus Object path */
+	uint16_t interval;		/* Boundaries: interval multiples */
+	struct l_queue *member_list;
+	unsigned int pending;		/* Members not read yet */
+	uint64_t timestamp;		/* Current boundary (us since epoch) */
+	uint64_t first;			/* First read of the boundary */
+	uint64_t last;			/* Last read of the boundary */
+	/* Published snapshot */
+	uint64_t pub_timestamp;
+	uint32_t pub_spread;
+	bool pub_complete;
+};
+
+static struct l_hashmap *snapshot_map;	/* name -> snapshot */
+
+static bool member_cmp(const void *a, const void *b)
+{
+	const struct member *member = a;
+
+	return (member->source == b ? true : false);
+}
+
+static void member_reset(void *data, void *user_data)
+{
+	struct member *member = data;
+
+	member->done = false;
+}
+
+static void member_publish(void *data, void *user_data)
+{
+	struct member *member = data;
+
+	if (member->done)
+		member->published = member->value;
+}
+
+static void snapshot_publish(struct snapshot *snapshot, bool complete)
+{
+	l_queue_foreach(snapshot->member_list, member_publish, NULL);
+
+	snapshot->pub_timestamp = snapshot->timestamp;
+	snapshot->pub_spread = snapshot->last - snapshot->first;
+	snapshot->pub_complete = complete;
+
+	/* Emitted together: one PropertiesChanged signal */
+	l_dbus_property_changed(dbus_get_bus(), snapshot->path,
+				SNAPSHOT_IFACE, "Timestamp");
+	l_dbus_property_changed(dbus_get_bus(), snapshot->path,
+				SNAPSHOT_IFACE, "Spread");
+	l_dbus_property_changed(dbus_get_bus(), snapshot->path,
+				SNAPSHOT_IFACE, "Complete");
+	l_dbus_property_changed(dbus_get_bus(), snapshot->path,
+				SNAPSHOT_IFACE, "Values");
+}
+
+static bool property_get_name(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct snapshot *snapshot = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 's', snapshot->name);
+
+	return true;
+}
+
+static bool property_get_interval(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct snapshot *snapshot = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'q',
+					    &snapshot->interval);
+
+	return true;
+}
+
+static bool property_get_timestamp(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct snapshot *snapshot = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 't',
+					    &snapshot->pub_timestamp);
+
+	return true;
+}
+
+static bool property_get_spread(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct snapshot *snapshot = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'u',
+					    &snapshot->pub_spread);
+
+	return true;
+}
+
+static bool property_get_complete(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct snapshot *snapshot = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'b',
+					    &snapshot->pub_complete);
+
+	return true;
+}
+
+static bool property_get_values(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct snapshot *snapshot = user_data;
+	const struct l_queue_entry *entry;
+	struct member *member;
+	const char *sig;
+
+	l_dbus_message_builder_enter_array(builder, "{ov}");
+
+	for (entry = l_queue_get_entries(snapshot->member_list);
+	     entry; entry = entry->next) {
+		member = entry->data;
+		sig = source_get_signature(member->source);
+
+		l_dbus_message_builder_enter_dict(builder, "ov");
+		l_dbus_message_builder_append_basic(builder, 'o',
+					source_get_path(member->source));
+		l_dbus_message_builder_enter_variant(builder, sig);
+		l_dbus_message_builder_append_basic(builder, sig[0],
+						    &member->published);
+		l_dbus_message_builder_leave_variant(builder);
+		l_dbus_message_builder_leave_dict(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+
+	return true;
+}
+
+static void setup_interface(struct l_dbus_interface *interface)
+{
+	if (!l_dbus_interface_property(interface, "Name", 0, "s",
+				       property_get_name,
+				       NULL))
+		l_error("Can't add 'Name' property");
+
+	/* Boundaries: wall clock multiples of the interval */
+	if (!l_dbus_interface_property(interface, "PollingInterval", 0, "q",
+				       property_get_interval,
+				       NULL))
+		l_error("Can't add 'PollingInterval' property");
+
+	/* Boundary of the published values: us since epoch */
+	if (!l_dbus_interface_property(interface, "Timestamp", 0, "t",
+				       property_get_timestamp,
+				       NULL))
+		l_error("Can't add 'Timestamp' property");
+
+	/* Time between the first and the last read in us */
+	if (!l_dbus_interface_property(interface, "Spread", 0, "u",
+				       property_get_spread,
+				       NULL))
+		l_error("Can't add 'Spread' property");
+
+	/* False if some member couldn't be read before the next boundary */
+	if (!l_dbus_interface_property(interface, "Complete", 0, "b",
+				       property_get_complete,
+				       NULL))
+		l_error("Can't add 'Complete' property");
+
+	if (!l_dbus_interface_property(interface, "Values", 0, "a{ov}",
+				       property_get_values,
+				       NULL))
+		l_error("Can't add 'Values' property");
+}
+
+static void snapshot_free(struct snapshot *snapshot)
+{
+	l_queue_destroy(snapshot->member_list, l_free);
+	l_free(snapshot->name);
+	l_free(snapshot->path);
+	l_free(snapshot);
+}
+
+static struct snapshot *snapshot_new(const char *name, uint16_t interval)
+{
+	struct snapshot *snapshot;
+
+	snapshot = l_new(struct snapshot, 1);
+	snapshot->name = l_strdup(name);
+	snapshot->path = l_strdup_printf("/snapshot_%s", name);
+	snapshot->interval = interval;
+	snapshot->member_list = l_queue_new();
+	snapshot->pending = 0;
+	snapshot->timestamp = 0;
+	snapshot->pub_timestamp = 0;
+	snapshot->pub_spread = 0;
+	snapshot->pub_complete = false;
+
+	if (!l_dbus_register_object(dbus_get_bus(),
+				    snapshot->path,
+				    snapshot, NULL,
+				    SNAPSHOT_IFACE, snapshot,
+				    L_DBUS_INTERFACE_PROPERTIES,
+				    snapshot,
+				    NULL)) {
+		l_error("Can not register: %s", snapshot->path);
+		snapshot_free(snapshot);
+		return NULL;
+	}
+
+	l_info("New snapshot: %s", snapshot->path);
+
+	if (!snapshot_map)
+		snapshot_map = l_hashmap_string_new();
+
+	l_hashmap_insert(snapshot_map, snapshot->name, snapshot);
+
+	return snapshot;
+}
+
+static struct snapshot *snapshot_lookup(const char *name)
+{
+	if (!snapshot_map || !name)
+		return NULL;
+
+	return l_hashmap_lookup(snapshot_map, name);
+}
+
+int snapshot_start(void)
+{
+	l_info("Starting snapshot ...");
+
+	if (!l_dbus_register_interface(dbus_get_bus(),
+				       SNAPSHOT_IFACE,
+				       setup_interface,
+				       NULL, false)) {
+		l_error("dbus: unable to register %s", SNAPSHOT_IFACE);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+void snapshot_stop(void)
+{
+	l_dbus_unregister_interface(dbus_get_bus(),
+				    SNAPSHOT_IFACE);
+}
+
+/* Used at the object path: letters, digits and underscore */
+bool snapshot_name_is_valid(const char *name)
+{
+	const char *c;
+
+	if (!name || name[0] == '\0' || strlen(name) > 64)
+		return false;
+
+	for (c = name; *c; c++)
+		if (!l_ascii_isalnum(*c) && *c != '_')
+			return false;
+
+	return true;
+}
+
+/* Members share the polling interval of the group */
+int snapshot_add(const char *name, struct source *source)
+{
+	struct snapshot *snapshot;
+	struct member *member;
+
+	snapshot = snapshot_lookup(name);
+	if (!snapshot) {
+		snapshot = snapshot_new(name, source_get_interval(source));
+		if (!snapshot)
+			return -EINVAL;
+	} else if (snapshot->interval != source_get_interval(source)) {
+		return -EINVAL;
+	}
+
+	member = l_new(struct member, 1);
+	member->source = source;
+	member->value = 0;
+	member->published = 0;
+	member->done = false;
+
+	l_queue_push_tail(snapshot->member_list, member);
+
+	/* Joined mid cycle: waited from the next boundary */
+
+	return 0;
+}
+
+void snapshot_remove(const char *name, struct source *source)
+{
+	struct snapshot *snapshot;
+	struct member *member;
+
+	snapshot = snapshot_lookup(name);
+	if (!snapshot)
+		return;
+
+	member = l_queue_remove_if(snapshot->member_list,
+				   member_cmp, source);
+	if (!member)
+		return;
+
+	if (!member->done && snapshot->pending)
+		snapshot->pending--;
+
+	l_free(member);
+
+	if (!l_queue_isempty(snapshot->member_list))
+		return;
+
+	l_hashmap_remove(snapshot_map, snapshot->name);
+	l_dbus_unregister_object(dbus_get_bus(), snapshot->path);
+	snapshot_free(snapshot);
+}
+
+/* Boundary reached by one of the members */
+void snapshot_begin(const char *name, uint64_t timestamp)
+{
+	struct snapshot *snapshot;
+
+	snapshot = snapshot_lookup(name);
+	if (!snapshot || timestamp <= snapshot->timestamp)
+		return;
+
+	/* Previous boundary not completed in time */
+	if (snapshot->timestamp && snapshot->pending &&
+	    snapshot->pending < l_queue_length(snapshot->member_list))
+		snapshot_publish(snapshot, false);
+
+	snapshot->timestamp = timestamp;
+	snapshot->pending = l_queue_length(snapshot->member_list);
+	snapshot->first = 0;
+	snapshot->last = 0;
+	l_queue_foreach(snapshot->member_list, member_reset, NULL);
+}
+
+/* Source read for the boundary 'timestamp' at 'now' (us since epoch) */
+void snapshot_update(const char *name, struct source *source,
+		     uint64_t timestamp, uint64_t now)
+{
+	struct snapshot *snapshot;
+	struct member *member;
+
+	snapshot = snapshot_lookup(name);
+	if (!snapshot || timestamp != snapshot->timestamp)
+		return;
+
+	member = l_queue_find(snapshot->member_list, member_cmp, source);
+	if (!member || member->done)
+		return;
+
+	member->value = source_get_value(source);
+	member->done = true;
+
+	if (!snapshot->first || now < snapshot->first)
+		snapshot->first = now;
+	if (now > snapshot->last)
+		snapshot->last = now;
+
+	if (--snapshot->pending == 0)
+		snapshot_publish(snapshot, true);
+}
@@ -0,0 +1,40 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Snapshot groups: sources, possibly from different slaves and links,
+ * read at the same wall clock boundaries. Values read for a boundary
+ * are published at once, timestamped, when every member has been read
+ * or when the next boundary starts.
+ */
+
+struct source;
+
+int snapshot_start(void);
+void snapshot_stop(void);
+
+bool snapshot_name_is_valid(const char *name);
+int snapshot_add(const char *name, struct source *source);
+void snapshot_remove(const char *name, struct source *source);
+
+void snapshot_begin(const char *name, uint64_t timestamp);
+void snapshot_update(const char *name, struct source *source,
+		     uint64_t timestamp, uint64_t now);
@@ -30,6 +30,8 @@
 
 #include "dbus.h"
 #include "storage.h"
+#include "driver.h"
+#include "image.h"
 #include "source.h"
 
 struct source {
@@ -38,23 +40,65 @@ struct source {
 	char *name;		/* Local name */
 	char *sig;		/* D-Bus like signature */
 	char *unit;		/* Unit symbol based on IEEE 260.1 */
+	int table;		/* Register table: modbus_table */
 	uint16_t address;	/* PLC memory address */
 	uint16_t interval;	/* Polling interval in ms */
+	uint16_t max_interval;	/* Adaptive polling upper bound in ms */
+	bool aligned;		/* Polling not spread across the interval */
+	int priority;		/* Request class: modbus_priority */
+	char *snapshot;		/* Snapshot group name or NULL */
+	int trigger_table;	/* Trigger source table: modbus_table */
+	uint16_t trigger;	/* Trigger source address or 0xffff */
+	uint64_t trigger_mask;	/* Trigger value mask: 0 for any change */
+	source_changed_func_t changed_cb;
+	void *changed_data;
 	int storage;		/* Storage identification */
-	union {
-		bool vbool;
-		uint8_t vu8;
-		uint16_t vu16;
-		uint32_t vu32;
-		uint64_t vu64;
-	} value;
+	uint32_t jitter;	/* Polling lateness average in us */
+	uint32_t jitter_max;	/* Polling lateness peak in us */
+	uint32_t overruns;	/* Deadlines missed */
+	const struct image *image;	/* Slave register image: value view */
 };
 
+static const char *priority_str[] = {
+	[MODBUS_PRIORITY_CRITICAL] = "critical",
+	[MODBUS_PRIORITY_NORMAL] = "normal",
+	[MODBUS_PRIORITY_BACKGROUND] = "background",
+};
+
+static const char *table_str[] = {
+	[MODBUS_TABLE_COILS] = "coils",
+	[MODBUS_TABLE_DISCRETE_INPUTS] = "discrete-inputs",
+	[MODBUS_TABLE_INPUT_REGISTERS] = "input-registers",
+	[MODBUS_TABLE_HOLDING_REGISTERS] = "holding-registers",
+};
+
+/*
+ * Storage group and object path prefix. Discrete inputs and holding
+ * registers keep the plain address used before tables were introduced:
+ * prefixing either would orphan stored sources and change published
+ * paths. They share a namespace, so an address is assigned to one of
+ * them only (see source_has_key()).
+ */
+static const char *table_prefix[] = {
+	[MODBUS_TABLE_COILS] = "coil_",
+	[MODBUS_TABLE_DISCRETE_INPUTS] = "",
+	[MODBUS_TABLE_INPUT_REGISTERS] = "input_",
+	[MODBUS_TABLE_HOLDING_REGISTERS] = "",
+};
+
+#define GROUP_LEN	16
+
+static void group_name(int table, uint16_t address, char *group)
+{
+	snprintf(group, GROUP_LEN, "%s0x%04x", table_prefix[table], address);
+}
+
 static void source_free(struct source *source)
 {
 	l_free(source->name);
 	l_free(source->sig);
 	l_free(source->unit);
+	l_free(source->snapshot);
 	l_free(source->path);
 	l_info("source_free(%p)", source);
 	l_free(source);
@@ -101,7 +145,7 @@ static struct l_dbus_message *property_set_name(struct l_dbus *dbus,
 					 l_dbus_property_complete_cb_t complete,
 					 void *user_data)
 {
-	char addrstr[7];
+	char addrstr[GROUP_LEN];
 	struct source *source = user_data;
 	const char *name;
 
@@ -111,7 +155,7 @@ static struct l_dbus_message *property_set_name(struct l_dbus *dbus,
 	l_free(source->name);
 	source->name = l_strdup(name);
 
-	snprintf(addrstr, sizeof(addrstr), "0x%04x", source->address);
+	group_name(source->table, source->address, addrstr);
 	storage_write_key_string(source->storage, addrstr, "Name", name);
 
 	complete(dbus, msg, NULL);
@@ -155,16 +199,55 @@ static bool property_get_address(struct l_dbus *dbus,
 	return true;
 }
 
+static bool property_get_table(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 's',
+					    table_str[source->table]);
+
+	return true;
+}
+
 static bool property_get_value(struct l_dbus *dbus,
 				  struct l_dbus_message *msg,
 				  struct l_dbus_message_builder *builder,
 				  void *user_data)
 {
 	struct source *source = user_data;
+	uint64_t raw = source_get_value(source);
+	union {
+		bool vbool;
+		uint8_t vu8;
+		uint16_t vu16;
+		uint32_t vu32;
+		uint64_t vu64;
+	} value;
+
+	switch (source->sig[0]) {
+	case 'b':
+		value.vbool = (raw ? true : false);
+		break;
+	case 'y':
+		value.vu8 = raw;
+		break;
+	case 'q':
+		value.vu16 = raw;
+		break;
+	case 'u':
+		value.vu32 = raw;
+		break;
+	default:
+		value.vu64 = raw;
+		break;
+	}
 
 	l_dbus_message_builder_enter_variant(builder, source->sig);
 	l_dbus_message_builder_append_basic(builder,
-					    source->sig[0], &source->value);
+					    source->sig[0], &value);
 	l_dbus_message_builder_leave_variant(builder);
 
 	return true;
@@ -182,6 +265,132 @@ static bool property_get_interval(struct l_dbus *dbus,
 	return true;
 }
 
+static bool property_get_max_interval(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'q',
+					    &source->max_interval);
+
+	return true;
+}
+
+static bool property_get_phase_aligned(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'b', &source->aligned);
+
+	return true;
+}
+
+static bool property_get_priority(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 's',
+				source_priority_to_string(source->priority));
+
+	return true;
+}
+
+static bool property_get_snapshot(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 's',
+				source->snapshot ? source->snapshot : "");
+
+	return true;
+}
+
+static bool property_get_trigger(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'q', &source->trigger);
+
+	return true;
+}
+
+static bool property_get_trigger_table(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 's',
+				table_str[source->trigger_table]);
+
+	return true;
+}
+
+static bool property_get_trigger_mask(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 't',
+					    &source->trigger_mask);
+
+	return true;
+}
+
+static bool property_get_jitter(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'u', &source->jitter);
+
+	return true;
+}
+
+static bool property_get_jitter_max(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'u',
+					    &source->jitter_max);
+
+	return true;
+}
+
+static bool property_get_overruns(struct l_dbus *dbus,
+				  struct l_dbus_message *msg,
+				  struct l_dbus_message_builder *builder,
+				  void *user_data)
+{
+	struct source *source = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'u', &source->overruns);
+
+	return true;
+}
+
 static void setup_interface(struct l_dbus_interface *interface)
 {
 	/* Variable alias */
@@ -207,6 +416,12 @@ static void setup_interface(struct l_dbus_interface *interface)
 				       NULL))
 		l_error("Can't add 'Address' property");
 
+	/* Register table: address space of 'Address' */
+	if (!l_dbus_interface_property(interface, "Table", 0, "s",
+				       property_get_table,
+				       NULL))
+		l_error("Can't add 'Table' property");
+
 	/* Variable RAW Value */
 	if (!l_dbus_interface_property(interface, "Value", 0, "v",
 				       property_get_value,
@@ -219,6 +434,131 @@ static void setup_interface(struct l_dbus_interface *interface)
 				       NULL))
 		l_error("Can't add 'PollingInterval' property");
 
+	/* Adaptive polling: interval backs off up to this value */
+	if (!l_dbus_interface_property(interface, "MaxPollingInterval", 0, "q",
+				       property_get_max_interval,
+				       NULL))
+		l_error("Can't add 'MaxPollingInterval' property");
+
+	/* Polling at interval multiples: same phase as other sources */
+	if (!l_dbus_interface_property(interface, "PhaseAligned", 0, "b",
+				       property_get_phase_aligned,
+				       NULL))
+		l_error("Can't add 'PhaseAligned' property");
+
+	/* Request class: critical, normal or background */
+	if (!l_dbus_interface_property(interface, "Priority", 0, "s",
+				       property_get_priority,
+				       NULL))
+		l_error("Can't add 'Priority' property");
+
+	/* Wall clock aligned polling group: empty if none */
+	if (!l_dbus_interface_property(interface, "Snapshot", 0, "s",
+				       property_get_snapshot,
+				       NULL))
+		l_error("Can't add 'Snapshot' property");
+
+	/* Read on trigger source changes: 0xffff if polled */
+	if (!l_dbus_interface_property(interface, "Trigger", 0, "q",
+				       property_get_trigger,
+				       NULL))
+		l_error("Can't add 'Trigger' property");
+
+	if (!l_dbus_interface_property(interface, "TriggerTable", 0, "s",
+				       property_get_trigger_table,
+				       NULL))
+		l_error("Can't add 'TriggerTable' property");
+
+	if (!l_dbus_interface_property(interface, "TriggerMask", 0, "t",
+				       property_get_trigger_mask,
+				       NULL))
+		l_error("Can't add 'TriggerMask' property");
+
+	/* Polling schedule statistics */
+	if (!l_dbus_interface_property(interface, "Jitter", 0, "u",
+				       property_get_jitter,
+				       NULL))
+		l_error("Can't add 'Jitter' property");
+
+	if (!l_dbus_interface_property(interface, "MaxJitter", 0, "u",
+				       property_get_jitter_max,
+				       NULL))
+		l_error("Can't add 'MaxJitter' property");
+
+	if (!l_dbus_interface_property(interface, "Overruns", 0, "u",
+				       property_get_overruns,
+				       NULL))
+		l_error("Can't add 'Overruns' property");
+
+}
+
+/* Return the priority class or -EINVAL */
+int source_priority_from_string(const char *str)
+{
+	int prio;
+
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++)
+		if (strcmp(str, priority_str[prio]) == 0)
+			return prio;
+
+	return -EINVAL;
+}
+
+const char *source_priority_to_string(int prio)
+{
+	if (prio < 0 || prio >= MODBUS_PRIORITY_MAX)
+		return NULL;
+
+	return priority_str[prio];
+}
+
+/* Return the register table or -EINVAL */
+int source_table_from_string(const char *str)
+{
+	int table;
+
+	for (table = 0; table < MODBUS_TABLE_MAX; table++)
+		if (strcmp(str, table_str[table]) == 0)
+			return table;
+
+	return -EINVAL;
+}
+
+const char *source_table_to_string(int table)
+{
+	if (table < 0 || table >= MODBUS_TABLE_MAX)
+		return NULL;
+
+	return table_str[table];
+}
+
+/* Table read before tables were configurable: FC2 bits, FC3 registers */
+int source_table_default(const char *sig)
+{
+	return (sig[0] == 'b' || sig[0] == 'y' ?
+		MODBUS_TABLE_DISCRETE_INPUTS :
+		MODBUS_TABLE_HOLDING_REGISTERS);
+}
+
+/* Bool and byte are read from bit tables, integers from registers */
+bool source_table_is_valid(int table, const char *sig)
+{
+	if (table < 0 || table >= MODBUS_TABLE_MAX)
+		return false;
+
+	return (MODBUS_TABLE_IS_BITS(table) ==
+		MODBUS_TABLE_IS_BITS(source_table_default(sig)));
+}
+
+/*
+ * True if (table, address) maps to the storage group of 'source'. A
+ * discrete input and a holding register at the same address collide.
+ */
+bool source_has_key(const struct source *source, int table,
+		    uint16_t address)
+{
+	return (source->address == address &&
+		strcmp(table_prefix[source->table], table_prefix[table]) == 0);
 }
 
 int source_start(void)
@@ -243,26 +583,40 @@ void source_stop(void)
 }
 
 struct source *source_create(const char *prefix, const char *name,
-			     const char *sig, const char *unit,
+			     const char *sig, const char *unit, int table,
 			     uint16_t address, uint16_t interval,
 			     int storage_id, bool store)
 {
-	char addrstr[7];
+	char addrstr[GROUP_LEN];
 	struct source *source;
 	char *dpath;
 
-	dpath = l_strdup_printf("%s/source_%04x", prefix, address);
+	dpath = l_strdup_printf("%s/source_%s%04x", prefix,
+				table_prefix[table], address);
 
 	source = l_new(struct source, 1);
 	source->refs = 0;
 	source->name = l_strdup(name);
 	source->sig= l_strdup(sig);
 	source->unit = l_strdup(unit);
+	source->table = table;
 	source->address = address;
 	source->path = NULL;
 	source->interval = interval;
+	source->max_interval = 0;
+	source->aligned = false;
+	source->priority = MODBUS_PRIORITY_NORMAL;
+	source->snapshot = NULL;
+	source->trigger_table = table;
+	source->trigger = 0xffff;
+	source->trigger_mask = 0;
+	source->changed_cb = NULL;
+	source->changed_data = NULL;
 	source->storage = storage_id;
-	memset(&source->value, 0, sizeof(source->value));
+	source->jitter = 0;
+	source->jitter_max = 0;
+	source->overruns = 0;
+	source->image = NULL;
 
 	if (!l_dbus_register_object(dbus_get_bus(),
 				    dpath,
@@ -286,9 +640,11 @@ struct source *source_create(const char *prefix, const char *name,
 	 * storage, 'true' means that a new source object has been created.
 	 */
 	if (store) {
-		snprintf(addrstr, sizeof(addrstr), "0x%04x", address);
+		group_name(table, address, addrstr);
 		storage_write_key_string(storage_id, addrstr, "Name", name);
 		storage_write_key_string(storage_id, addrstr, "Type", sig);
+		storage_write_key_string(storage_id, addrstr, "Table",
+					 table_str[table]);
 		storage_write_key_string(storage_id, addrstr, "Unit", unit);
 		storage_write_key_int(storage_id, addrstr,
 				      "PollingInterval", interval);
@@ -299,7 +655,7 @@ struct source *source_create(const char *prefix, const char *name,
 
 void source_destroy(struct source *source, bool del)
 {
-	char addrstr[7];
+	char addrstr[GROUP_LEN];
 
 	l_info("source_destroy(%p)", source);
 
@@ -307,7 +663,7 @@ void source_destroy(struct source *source, bool del)
 		return;
 
 	if (del) {
-		snprintf(addrstr, sizeof(addrstr), "0x%04x", source->address);
+		group_name(source->table, source->address, addrstr);
 
 		if (storage_remove_group(source->storage, addrstr) < 0)
 			l_info("storage(): Can't delete source!");
@@ -333,6 +689,14 @@ const char *source_get_signature(const struct source *source)
 	return source->sig;
 }
 
+int source_get_table(const struct source *source)
+{
+	if (unlikely(!source))
+		return MODBUS_TABLE_HOLDING_REGISTERS;
+
+	return source->table;
+}
+
 uint16_t source_get_address(const struct source *source)
 {
 	if (unlikely(!source))
@@ -349,82 +713,223 @@ uint16_t source_get_interval(const struct source *source)
 	return source->interval;
 }
 
-bool source_set_value_bool(struct source *source, bool value)
+uint16_t source_get_max_interval(const struct source *source)
 {
 	if (unlikely(!source))
-		return false;
+		return 0;
 
-	if (source->value.vbool == value)
-		return true;
+	return source->max_interval;
+}
 
-	source->value.vbool = value;
+void source_set_max_interval(struct source *source, uint16_t max_interval,
+			     bool store)
+{
+	char addrstr[GROUP_LEN];
 
-	l_dbus_property_changed(dbus_get_bus(), source->path,
-				SOURCE_IFACE, "Value");
+	if (unlikely(!source))
+		return;
 
-	return true;
+	/* Below the polling interval: adaptive polling disabled */
+	source->max_interval = (max_interval > source->interval ?
+				max_interval : 0);
+
+	if (!store)
+		return;
+
+	group_name(source->table, source->address, addrstr);
+	storage_write_key_int(source->storage, addrstr,
+			      "MaxPollingInterval", source->max_interval);
 }
 
-bool source_set_value_byte(struct source *source, uint8_t value)
+bool source_get_phase_aligned(const struct source *source)
 {
 	if (unlikely(!source))
 		return false;
 
-	if (source->value.vu8 == value)
-		return true;
+	return source->aligned;
+}
 
-	source->value.vu8 = value;
+void source_set_phase_aligned(struct source *source, bool aligned,
+			      bool store)
+{
+	char addrstr[GROUP_LEN];
 
-	l_dbus_property_changed(dbus_get_bus(), source->path,
-				SOURCE_IFACE, "Value");
+	if (unlikely(!source))
+		return;
 
-	return true;
+	source->aligned = aligned;
+
+	if (!store)
+		return;
+
+	group_name(source->table, source->address, addrstr);
+	storage_write_key_bool(source->storage, addrstr,
+			       "PhaseAligned", aligned);
 }
 
-bool source_set_value_u16(struct source *source, uint16_t value)
+int source_get_priority(const struct source *source)
 {
 	if (unlikely(!source))
-		return false;
+		return MODBUS_PRIORITY_NORMAL;
 
-	if (source->value.vu16 == value)
-		return true;
+	return source->priority;
+}
 
-	source->value.vu16 = value;
+void source_set_priority(struct source *source, int prio, bool store)
+{
+	char addrstr[GROUP_LEN];
 
-	l_dbus_property_changed(dbus_get_bus(), source->path,
-				SOURCE_IFACE, "Value");
+	if (unlikely(!source))
+		return;
 
-	return true;
+	if (prio < 0 || prio >= MODBUS_PRIORITY_MAX)
+		return;
+
+	source->priority = prio;
+
+	if (!store)
+		return;
+
+	group_name(source->table, source->address, addrstr);
+	storage_write_key_string(source->storage, addrstr, "Priority",
+				 priority_str[prio]);
 }
 
-bool source_set_value_u32(struct source *source, uint32_t value)
+const char *source_get_snapshot(const struct source *source)
 {
 	if (unlikely(!source))
-		return false;
+		return NULL;
 
-	if (source->value.vu32 == value)
-		return true;
+	return source->snapshot;
+}
 
-	source->value.vu32 = value;
+void source_set_snapshot(struct source *source, const char *name,
+			 bool store)
+{
+	char addrstr[GROUP_LEN];
 
-	l_dbus_property_changed(dbus_get_bus(), source->path,
-				SOURCE_IFACE, "Value");
+	if (unlikely(!source))
+		return;
 
-	return true;
+	l_free(source->snapshot);
+	source->snapshot = (name && name[0] ? l_strdup(name) : NULL);
+
+	if (!store || !source->snapshot)
+		return;
+
+	group_name(source->table, source->address, addrstr);
+	storage_write_key_string(source->storage, addrstr, "Snapshot",
+				 source->snapshot);
 }
 
-bool source_set_value_u64(struct source *source, uint64_t value)
+uint16_t source_get_trigger(const struct source *source)
 {
 	if (unlikely(!source))
-		return false;
+		return 0xffff;
+
+	return source->trigger;
+}
+
+int source_get_trigger_table(const struct source *source)
+{
+	if (unlikely(!source))
+		return MODBUS_TABLE_HOLDING_REGISTERS;
+
+	return source->trigger_table;
+}
+
+uint64_t source_get_trigger_mask(const struct source *source)
+{
+	if (unlikely(!source))
+		return 0;
+
+	return source->trigger_mask;
+}
+
+void source_set_trigger(struct source *source, int table, uint16_t trigger,
+			uint64_t mask, bool store)
+{
+	char addrstr[GROUP_LEN];
+
+	if (unlikely(!source))
+		return;
+
+	source->trigger_table = table;
+	source->trigger = trigger;
+	source->trigger_mask = mask;
+
+	if (!store || trigger == 0xffff)
+		return;
+
+	group_name(source->table, source->address, addrstr);
+	storage_write_key_string(source->storage, addrstr, "TriggerTable",
+				 table_str[table]);
+	storage_write_key_int(source->storage, addrstr, "Trigger", trigger);
+	storage_write_key_uint64(source->storage, addrstr, "TriggerMask",
+				 mask);
+}
 
-	if (source->value.vu64 == value)
-		return true;
+void source_set_changed_func(struct source *source,
+			     source_changed_func_t func, void *user_data)
+{
+	if (unlikely(!source))
+		return;
 
-	source->value.vu64 = value;
+	source->changed_cb = func;
+	source->changed_data = user_data;
+}
+
+/* Raw value widened to 64 bits: zero until read */
+uint64_t source_get_value(const struct source *source)
+{
+	if (unlikely(!source || !source->image))
+		return 0;
+
+	return image_get_value(source->image, source->table, source->sig,
+			       source->address);
+}
+
+void source_set_image(struct source *source, const struct image *image)
+{
+	if (unlikely(!source))
+		return;
+
+	source->image = image;
+}
+
+void source_update_timing(struct source *source, uint32_t jitter,
+			  bool overrun)
+{
+	if (unlikely(!source))
+		return;
+
+	/* Moving average: 1/8 of the new sample */
+	source->jitter = source->jitter - (source->jitter >> 3) + (jitter >> 3);
+
+	if (jitter > source->jitter_max)
+		source->jitter_max = jitter;
+
+	/* Jitter changes every cycle: signal overruns only */
+	if (!overrun)
+		return;
+
+	source->overruns++;
+
+	l_dbus_property_changed(dbus_get_bus(), source->path,
+				SOURCE_IFACE, "Overruns");
+}
+
+/* Value changed at the image */
+void source_notify(struct source *source)
+{
+	if (unlikely(!source))
+		return;
 
 	l_dbus_property_changed(dbus_get_bus(), source->path,
 				SOURCE_IFACE, "Value");
 
-	return true;
+	/* Triggers: dependent sources are read on change */
+	if (source->changed_cb)
+		source->changed_cb(source, source_get_value(source),
+				   source->changed_data);
 }
@@ -20,23 +20,56 @@
  */
 
 struct source;
+struct image;
+
+/* Value changed: 'value' is the new value widened to 64 bits */
+typedef void (*source_changed_func_t) (struct source *source, uint64_t value,
+				       void *user_data);
 
 int source_start(void);
+
+int source_priority_from_string(const char *str);
+const char *source_priority_to_string(int prio);
+int source_table_from_string(const char *str);
+const char *source_table_to_string(int table);
+int source_table_default(const char *sig);
+bool source_table_is_valid(int table, const char *sig);
 void source_stop(void);
 
 struct source;
 struct source *source_create(const char *prefix, const char *name,
-			     const char *sig, const char *unit,
+			     const char *sig, const char *unit, int table,
 			     uint16_t address, uint16_t interval,
 			     int storage_id, bool store);
 void source_destroy(struct source *source, bool del);
 const char *source_get_path(const struct source *source);
 const char *source_get_signature(const struct source *source);
+int source_get_table(const struct source *source);
 uint16_t source_get_address(const struct source *source);
+bool source_has_key(const struct source *source, int table,
+		    uint16_t address);
 uint16_t source_get_interval(const struct source *source);
+uint16_t source_get_max_interval(const struct source *source);
+void source_set_max_interval(struct source *source, uint16_t max_interval,
+			     bool store);
+bool source_get_phase_aligned(const struct source *source);
+int source_get_priority(const struct source *source);
+void source_set_priority(struct source *source, int prio, bool store);
+void source_set_phase_aligned(struct source *source, bool aligned,
+			      bool store);
+const char *source_get_snapshot(const struct source *source);
+void source_set_snapshot(struct source *source, const char *name,
+			 bool store);
+uint64_t source_get_value(const struct source *source);
+void source_set_image(struct source *source, const struct image *image);
+int source_get_trigger_table(const struct source *source);
+uint16_t source_get_trigger(const struct source *source);
+uint64_t source_get_trigger_mask(const struct source *source);
+void source_set_trigger(struct source *source, int table, uint16_t trigger,
+			uint64_t mask, bool store);
+void source_set_changed_func(struct source *source,
+			     source_changed_func_t func, void *user_data);
 
-bool source_set_value_bool(struct source *source, bool value);
-bool source_set_value_byte(struct source *source, uint8_t value);
-bool source_set_value_u16(struct source *source, uint16_t value);
-bool source_set_value_u32(struct source *source, uint32_t value);
-bool source_set_value_u64(struct source *source, uint64_t value);
+void source_update_timing(struct source *source, uint32_t jitter,
+			  bool overrun);
+void source_notify(struct source *source);
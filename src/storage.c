@@ -270,6 +270,60 @@ int storage_read_key_int(int fd, const char *group, const char *key, int *value)
 	return l_settings_get_int(settings, group, key, value);
 }
 
+int storage_write_key_bool(int fd, const char *group, const char *key,
+			   bool value)
+{
+	struct l_settings *settings;
+
+	settings = l_hashmap_lookup(storage_list, L_INT_TO_PTR(fd));
+	if (!settings)
+		return -EINVAL;
+
+	if (l_settings_set_bool(settings, group, key, value) == false)
+		return -EINVAL;
+
+	return save_settings(fd, settings);
+}
+
+int storage_read_key_bool(int fd, const char *group, const char *key,
+			  bool *value)
+{
+	struct l_settings *settings;
+
+	settings = l_hashmap_lookup(storage_list, L_INT_TO_PTR(fd));
+	if (!settings)
+		return -EINVAL;
+
+	return l_settings_get_bool(settings, group, key, value);
+}
+
+int storage_write_key_uint64(int fd, const char *group, const char *key,
+			     uint64_t value)
+{
+	struct l_settings *settings;
+
+	settings = l_hashmap_lookup(storage_list, L_INT_TO_PTR(fd));
+	if (!settings)
+		return -EINVAL;
+
+	if (l_settings_set_uint64(settings, group, key, value) == false)
+		return -EINVAL;
+
+	return save_settings(fd, settings);
+}
+
+int storage_read_key_uint64(int fd, const char *group, const char *key,
+			    uint64_t *value)
+{
+	struct l_settings *settings;
+
+	settings = l_hashmap_lookup(storage_list, L_INT_TO_PTR(fd));
+	if (!settings)
+		return -EINVAL;
+
+	return l_settings_get_uint64(settings, group, key, value);
+}
+
 int storage_remove_group(int fd, const char *group)
 {
 	struct l_settings *settings;
@@ -50,4 +50,12 @@ int storage_write_key_int(int fd, const char *group,
 			  const char *key, int value);
 int storage_read_key_int(int fd, const char *group,
 			  const char *key, int *value);
+int storage_write_key_bool(int fd, const char *group,
+			   const char *key, bool value);
+int storage_read_key_bool(int fd, const char *group,
+			  const char *key, bool *value);
+int storage_write_key_uint64(int fd, const char *group,
+			     const char *key, uint64_t value);
+int storage_read_key_uint64(int fd, const char *group,
+			    const char *key, uint64_t *value);
 bool storage_has_unit(int fd, const char *group, const char *key);
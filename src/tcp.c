@@ -27,17 +27,899 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <ell/ell.h>
 
 #include <modbus.h>
 
+#include "options.h"
+#include "worker.h"
+#include "rtt.h"
 #include "driver.h"
 
-static modbus_t *create(const char *url)
+/*
+ * Native non-blocking modbus TCP master. Requests are framed as MBAP
+ * ADUs and up to 'MaxTransactions' are kept in flight per connection,
+ * matched by transaction identifier. Responses are received straight
+ * into the caller buffer.
+ *
+ * Slaves sharing the same endpoint (e.g. behind a gateway) share a
+ * single link: one connection and one request queue per priority class.
+ * Each request carries the unit id of the slave that submitted it.
+ * Free window slots are always given to the highest pending class.
+ *
+ * Connections never block the main loop: host names are resolved at a
+ * worker thread (numeric addresses inline) and cached, and candidate
+ * addresses are connected with non-blocking sockets, alternating IPv6
+ * and IPv4 and starting a new attempt every 250 ms while the previous
+ * ones are pending (happy eyeballs, RFC 8305). First to succeed wins.
+ */
+
+#define MBAP_LEN		7	/* Transaction, protocol, length, unit */
+#define RSP_HDR_LEN		(MBAP_LEN + 2)	/* Function and byte count */
+#define REQ_LEN			(MBAP_LEN + 5)	/* Function, address, nb */
+#define ADU_MAX			260
+#define WINDOW_MAX		16
+
+#define CONNECT_TIMEOUT		3000	/* ms */
+#define ATTEMPT_DELAY		250	/* ms: next address in parallel */
+#define RESOLVE_TTL		300	/* seconds: resolved addresses cache */
+#define ADDR_MAX		8	/* Candidate addresses per host */
+
+#define FC_READ_COILS			0x01
+#define FC_READ_DISCRETE_INPUTS		0x02
+#define FC_READ_HOLDING_REGISTERS	0x03
+#define FC_READ_INPUT_REGISTERS		0x04
+
+/* Register reads: payload is big endian u16, bits are packed */
+#define FC_IS_REGISTERS(fc)	((fc) == FC_READ_HOLDING_REGISTERS || \
+				 (fc) == FC_READ_INPUT_REGISTERS)
+
+struct tcp_link;
+struct tcp_connect;
+
+struct tcp_addr {
+	socklen_t len;
+	struct sockaddr_storage sa;
+};
+
+/* Per slave context attached to a shared link */
+struct tcp_ctx {
+	struct tcp_link *link;
+	uint8_t unit;
+	bool connected;
+	modbus_driver_func_t disconnected_cb;
+	void *user_data;
+	modbus_driver_func_t connect_cb;	/* Waiting for the link */
+	void *connect_data;
+	struct rtt rtt;				/* Response timeout */
+};
+
+struct txn {
+	struct tcp_link *link;
+	struct tcp_ctx *ctx;		/* Owner */
+	unsigned int id;		/* Local request id */
+	uint16_t tid;			/* MBAP transaction id */
+	uint8_t unit;
+	uint8_t fc;
+	enum modbus_priority prio;
+	uint64_t queued_at;		/* Submission time (l_time_now) */
+	uint64_t sent_at;		/* Round-trip time start */
+	uint16_t addr;
+	uint16_t nb;
+	void *out;
+	struct l_timeout *timeout;	/* Response timeout */
+	modbus_driver_func_t func;
+	void *user_data;
+	modbus_driver_destroy_func_t destroy;
+};
+
+struct tcp_link {
+	int refs;
+	char *key;			/* hostname:port */
+	char *hostname;
+	char *port;
+	struct l_io *io;
+	struct worker *worker;		/* Name resolution */
+	bool connecting;
+	struct tcp_connect *conn;	/* Connection attempts */
+	struct tcp_addr addr[ADDR_MAX];	/* Resolved: IPv6/IPv4 interleaved */
+	unsigned int naddr;
+	uint64_t resolved_until;	/* Cache expiration (l_time_now) */
+	struct l_queue *ctx_list;	/* Attached slaves */
+	struct l_queue *pending_list[MODBUS_PRIORITY_MAX]; /* Waiting slot */
+	struct l_queue *inflight_list;	/* Waiting for response */
+	unsigned int next_id;
+	uint16_t next_tid;
+	uint32_t delay[MODBUS_PRIORITY_MAX];	/* Queueing delay average */
+	uint8_t tx_buf[WINDOW_MAX * REQ_LEN];
+	size_t tx_len;
+	uint8_t rx_hdr[RSP_HDR_LEN];
+	size_t rx_hdr_len;
+	struct txn *rx_txn;		/* Transaction being received */
+	uint8_t *rx_dest;		/* Payload destination */
+	size_t rx_len;			/* Payload length */
+	size_t rx_off;			/* Payload received so far */
+	uint8_t rx_discard[ADU_MAX];
+};
+
+struct tcp_resolve {
+	struct tcp_link *link;		/* Don't touch at the worker */
+	char *hostname;
+	char *port;
+	struct addrinfo *res;
+	int err;
+};
+
+struct tcp_attempt {
+	struct tcp_connect *conn;
+	struct l_io *io;
+};
+
+struct tcp_connect {
+	struct tcp_link *link;
+	unsigned int next;		/* Next address to try */
+	struct l_queue *attempt_list;	/* Sockets connecting */
+	struct l_timeout *next_to;	/* Start the next attempt */
+	struct l_timeout *timeout;	/* Give up */
+	int err;			/* Last failure */
+};
+
+static struct l_hashmap *link_map;	/* hostname:port -> link */
+
+static bool tid_cmp(const void *a, const void *b)
+{
+	const struct txn *txn = a;
+	uint16_t tid = L_PTR_TO_UINT(b);
+
+	return (txn->tid == tid ? true : false);
+}
+
+static bool id_cmp(const void *a, const void *b)
+{
+	const struct txn *txn = a;
+	unsigned int id = L_PTR_TO_UINT(b);
+
+	return (txn->id == id ? true : false);
+}
+
+static int window_size(void)
+{
+	if (tcp_opts.transactions < 1)
+		return 1;
+
+	if (tcp_opts.transactions > WINDOW_MAX)
+		return WINDOW_MAX;
+
+	return tcp_opts.transactions;
+}
+
+static int exception_to_errno(uint8_t code)
+{
+	switch (code) {
+	case 0x02: /* Illegal data address */
+		return -EFAULT;
+	case 0x03: /* Illegal data value */
+		return -EINVAL;
+	default:
+		return -EIO;
+	}
+}
+
+static void txn_free(struct txn *txn)
+{
+	if (txn->timeout)
+		l_timeout_remove(txn->timeout);
+
+	if (txn->destroy)
+		txn->destroy(txn->user_data);
+
+	l_free(txn);
+}
+
+/* Stop writing to the caller buffer: remaining payload is discarded */
+static void rx_detach(struct tcp_link *link, struct txn *txn)
+{
+	if (link->rx_txn != txn)
+		return;
+
+	link->rx_txn = NULL;
+	link->rx_dest = link->rx_discard;
+}
+
+static void tcp_flush(struct tcp_link *link);
+static void tcp_send_pending(struct tcp_link *link);
+
+static void txn_complete(struct tcp_link *link, struct txn *txn, int err)
+{
+	l_queue_remove(link->inflight_list, txn);
+	rx_detach(link, txn);
+
+	/* Any response, exceptions included, is a round-trip sample */
+	if (err != -ETIMEDOUT)
+		rtt_sample(&txn->ctx->rtt, l_time_now() - txn->sent_at);
+
+	if (txn->func)
+		txn->func(err, txn->user_data);
+
+	txn_free(txn);
+
+	/* Slot released */
+	tcp_send_pending(link);
+}
+
+static void txn_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct txn *txn = user_data;
+
+	l_info("tcp(%s): transaction %d timed out",
+	       txn->link->key, txn->tid);
+
+	l_timeout_remove(txn->timeout);
+	txn->timeout = NULL;
+
+	rtt_expired(&txn->ctx->rtt);
+
+	txn_complete(txn->link, txn, -ETIMEDOUT);
+}
+
+static struct txn *pending_pop(struct tcp_link *link)
+{
+	struct txn *txn = NULL;
+	uint64_t delay;
+	int prio;
+
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX && !txn; prio++)
+		txn = l_queue_pop_head(link->pending_list[prio]);
+
+	if (!txn)
+		return NULL;
+
+	/* Moving average: 1/8 of the new sample */
+	delay = l_time_now() - txn->queued_at;
+	if (delay > UINT32_MAX)
+		delay = UINT32_MAX;
+
+	link->delay[txn->prio] = link->delay[txn->prio] -
+		(link->delay[txn->prio] >> 3) + ((uint32_t) delay >> 3);
+
+	return txn;
+}
+
+static void tcp_send_pending(struct tcp_link *link)
+{
+	struct txn *txn;
+	uint8_t *adu;
+	int window = window_size();
+
+	if (!link->io)
+		return;
+
+	while ((int) l_queue_length(link->inflight_list) < window &&
+	       link->tx_len + REQ_LEN <= sizeof(link->tx_buf)) {
+		txn = pending_pop(link);
+		if (!txn)
+			break;
+
+		txn->tid = link->next_tid++;
+
+		adu = &link->tx_buf[link->tx_len];
+		l_put_be16(txn->tid, &adu[0]);
+		l_put_be16(0, &adu[2]);			/* Protocol: modbus */
+		l_put_be16(REQ_LEN - 6, &adu[4]);	/* Unit and PDU */
+		adu[6] = txn->unit;
+		adu[7] = txn->fc;
+		l_put_be16(txn->addr, &adu[8]);
+		l_put_be16(txn->nb, &adu[10]);
+		link->tx_len += REQ_LEN;
+
+		txn->sent_at = l_time_now();
+		txn->timeout = l_timeout_create_ms(
+					rtt_get_timeout(&txn->ctx->rtt),
+					txn_timeout, txn, NULL);
+
+		l_queue_push_tail(link->inflight_list, txn);
+	}
+
+	tcp_flush(link);
+}
+
+static bool write_cb(struct l_io *io, void *user_data)
+{
+	struct tcp_link *link = user_data;
+	ssize_t len;
+
+	len = send(l_io_get_fd(io), link->tx_buf, link->tx_len,
+		   MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (len < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return true;
+
+		/* Disconnect handler releases the transactions */
+		shutdown(l_io_get_fd(io), SHUT_RDWR);
+		return false;
+	}
+
+	link->tx_len -= len;
+	memmove(link->tx_buf, &link->tx_buf[len], link->tx_len);
+
+	return (link->tx_len > 0);
+}
+
+static void tcp_flush(struct tcp_link *link)
+{
+	if (link->tx_len == 0)
+		return;
+
+	if (write_cb(link->io, link))
+		l_io_set_write_handler(link->io, write_cb, link, NULL);
+}
+
+static void rx_reset(struct tcp_link *link)
+{
+	link->rx_hdr_len = 0;
+	link->rx_txn = NULL;
+	link->rx_dest = NULL;
+	link->rx_len = 0;
+	link->rx_off = 0;
+}
+
+static void rx_complete(struct tcp_link *link)
+{
+	struct txn *txn = link->rx_txn;
+	uint16_t *regs;
+	int i;
+
+	rx_reset(link);
+
+	if (!txn)
+		return;
+
+	/* Convert in place: bits are delivered packed as received */
+	if (FC_IS_REGISTERS(txn->fc)) {
+		regs = txn->out;
+		for (i = 0; i < txn->nb; i++)
+			regs[i] = L_BE16_TO_CPU(regs[i]);
+	}
+
+	txn_complete(link, txn, 0);
+}
+
+/* MBAP header, function and byte count (or exception code) received */
+static bool rx_header(struct tcp_link *link)
+{
+	struct txn *txn;
+	uint16_t tid = l_get_be16(&link->rx_hdr[0]);
+	uint16_t pid = l_get_be16(&link->rx_hdr[2]);
+	uint16_t len = l_get_be16(&link->rx_hdr[4]);
+	uint8_t unit = link->rx_hdr[6];
+	uint8_t fc = link->rx_hdr[7];
+	uint8_t count = link->rx_hdr[8];
+	size_t expected;
+
+	if (pid != 0 || len < 3 || len > ADU_MAX - 6)
+		return false;
+
+	txn = l_queue_find(link->inflight_list, tid_cmp, L_UINT_TO_PTR(tid));
+	if (txn && (unit != txn->unit || (fc & 0x7f) != txn->fc))
+		txn = NULL;
+
+	if (fc & 0x80) {
+		if (len != 3)
+			return false;
+
+		rx_reset(link);
+
+		if (txn)
+			txn_complete(link, txn, exception_to_errno(count));
+
+		return true;
+	}
+
+	/* Unit, function and byte count are already received */
+	if (count != len - 3)
+		return false;
+
+	link->rx_len = count;
+	link->rx_off = 0;
+	link->rx_txn = NULL;
+	link->rx_dest = link->rx_discard;
+
+	/* Unknown, late or malformed response: discard the payload */
+	if (txn) {
+		if (FC_IS_REGISTERS(txn->fc))
+			expected = txn->nb * sizeof(uint16_t);
+		else
+			expected = (txn->nb + 7) / 8;
+
+		if (count == expected) {
+			link->rx_txn = txn;
+			link->rx_dest = txn->out;
+		} else
+			l_error("tcp(%s): unexpected byte count %d",
+				link->key, count);
+	}
+
+	if (link->rx_len == 0)
+		rx_complete(link);
+
+	return true;
+}
+
+static bool read_cb(struct l_io *io, void *user_data)
+{
+	struct tcp_link *link = user_data;
+	int fd = l_io_get_fd(io);
+	ssize_t len;
+
+	for (;;) {
+		if (link->rx_hdr_len < RSP_HDR_LEN)
+			len = recv(fd, &link->rx_hdr[link->rx_hdr_len],
+				   RSP_HDR_LEN - link->rx_hdr_len,
+				   MSG_DONTWAIT);
+		else
+			len = recv(fd, &link->rx_dest[link->rx_off],
+				   link->rx_len - link->rx_off, MSG_DONTWAIT);
+
+		if (len < 0 && (errno == EAGAIN || errno == EINTR))
+			return true;
+
+		if (len <= 0)
+			goto disconnect;
+
+		if (link->rx_hdr_len < RSP_HDR_LEN) {
+			link->rx_hdr_len += len;
+			if (link->rx_hdr_len == RSP_HDR_LEN &&
+			    !rx_header(link)) {
+				l_error("tcp(%s): invalid frame",
+					link->key);
+				goto disconnect;
+			}
+
+			continue;
+		}
+
+		link->rx_off += len;
+		if (link->rx_off == link->rx_len)
+			rx_complete(link);
+	}
+
+disconnect:
+	/* Disconnect handler releases the transactions */
+	shutdown(fd, SHUT_RDWR);
+
+	return false;
+}
+
+static void txn_fail(void *data, void *user_data)
+{
+	struct txn *txn = data;
+
+	if (txn->func)
+		txn->func(-ECONNRESET, txn->user_data);
+
+	txn_free(txn);
+}
+
+static void ctx_disconnected(void *data, void *user_data)
+{
+	struct tcp_ctx *ctx = data;
+
+	if (!ctx->connected)
+		return;
+
+	ctx->connected = false;
+
+	if (ctx->disconnected_cb)
+		ctx->disconnected_cb(-ECONNRESET, ctx->user_data);
+}
+
+static void disconnect_cb(struct l_io *io, void *user_data)
+{
+	struct tcp_link *link = user_data;
+	struct l_queue *inflight_list = link->inflight_list;
+	struct l_queue *pending_list;
+	int prio;
+
+	l_info("tcp(%s): disconnected", link->key);
+
+	l_io_destroy(link->io);
+	link->io = NULL;
+	link->tx_len = 0;
+	rx_reset(link);
+
+	link->inflight_list = l_queue_new();
+
+	l_queue_foreach(inflight_list, txn_fail, NULL);
+	l_queue_destroy(inflight_list, NULL);
+
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++) {
+		pending_list = link->pending_list[prio];
+		link->pending_list[prio] = l_queue_new();
+		l_queue_foreach(pending_list, txn_fail, NULL);
+		l_queue_destroy(pending_list, NULL);
+	}
+
+	l_queue_foreach(link->ctx_list, ctx_disconnected, NULL);
+}
+
+static void ctx_connected(void *data, void *user_data)
+{
+	struct tcp_ctx *ctx = data;
+	int err = L_PTR_TO_INT(user_data);
+	modbus_driver_func_t func = ctx->connect_cb;
+
+	/* Not waiting for the connection */
+	if (!func)
+		return;
+
+	ctx->connect_cb = NULL;
+	ctx->connected = (err == 0);
+
+	func(err, ctx->connect_data);
+}
+
+static void attempt_free(void *data)
+{
+	struct tcp_attempt *attempt = data;
+
+	l_io_destroy(attempt->io);
+	l_free(attempt);
+}
+
+static struct tcp_link *link_ref(struct tcp_link *link);
+static void link_unref(struct tcp_link *link);
+
+static void connect_free(struct tcp_connect *conn)
+{
+	l_queue_destroy(conn->attempt_list, attempt_free);
+	l_timeout_remove(conn->next_to);
+	l_timeout_remove(conn->timeout);
+	l_free(conn);
+}
+
+/* 'fd' is the connected socket or a negative errno */
+static void connect_finish(struct tcp_connect *conn, int fd)
+{
+	struct tcp_link *link = link_ref(conn->link);
+	int enable = 1;
+	int err = 0;
+
+	link->conn = NULL;
+	link->connecting = false;
+	connect_free(conn);
+
+	if (fd < 0) {
+		err = fd;
+		l_info("connect(%s): %s(%d)", link->key,
+		       strerror(-err), -err);
+
+		/* Host may have moved: resolve again on the next attempt */
+		link->resolved_until = 0;
+		goto done;
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+	link->io = l_io_new(fd);
+	if (!link->io) {
+		close(fd);
+		err = -EIO;
+		goto done;
+	}
+
+	l_io_set_close_on_destroy(link->io, true);
+	l_io_set_read_handler(link->io, read_cb, link, NULL);
+	l_io_set_disconnect_handler(link->io, disconnect_cb, link, NULL);
+
+	rx_reset(link);
+	link->tx_len = 0;
+
+done:
+	/* Every slave waiting for this link */
+	l_queue_foreach(link->ctx_list, ctx_connected, L_INT_TO_PTR(err));
+	link_unref(link);
+}
+
+static bool attempt_start(struct tcp_connect *conn);
+
+static bool attempt_cb(struct l_io *io, void *user_data)
+{
+	struct tcp_attempt *attempt = user_data;
+	struct tcp_connect *conn = attempt->conn;
+	socklen_t len = sizeof(int);
+	int fd = l_io_get_fd(io);
+	int err;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+
+	l_queue_remove(conn->attempt_list, attempt);
+
+	if (err == 0) {
+		/* Winner: keep the socket, drop the other attempts */
+		l_io_set_close_on_destroy(io, false);
+		attempt_free(attempt);
+		connect_finish(conn, fd);
+		return false;
+	}
+
+	conn->err = -err;
+	attempt_free(attempt);
+
+	/* Don't wait for the delay: nothing else is pending */
+	if (l_queue_isempty(conn->attempt_list) && !attempt_start(conn))
+		connect_finish(conn, conn->err);
+
+	return false;
+}
+
+/* Return false if there are no addresses left */
+static bool attempt_start(struct tcp_connect *conn)
+{
+	struct tcp_link *link = conn->link;
+	struct tcp_attempt *attempt;
+	struct tcp_addr *addr;
+	int fd;
+
+	while (conn->next < link->naddr) {
+		addr = &link->addr[conn->next++];
+
+		fd = socket(addr->sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC |
+			    SOCK_NONBLOCK, IPPROTO_TCP);
+		if (fd < 0) {
+			conn->err = -errno;
+			continue;
+		}
+
+		if (connect(fd, (struct sockaddr *) &addr->sa,
+			    addr->len) < 0 && errno != EINPROGRESS) {
+			conn->err = -errno;
+			close(fd);
+			continue;
+		}
+
+		attempt = l_new(struct tcp_attempt, 1);
+		attempt->conn = conn;
+		attempt->io = l_io_new(fd);
+		l_io_set_close_on_destroy(attempt->io, true);
+		l_io_set_write_handler(attempt->io, attempt_cb, attempt, NULL);
+		l_queue_push_tail(conn->attempt_list, attempt);
+
+		if (conn->next < link->naddr)
+			l_timeout_modify_ms(conn->next_to, ATTEMPT_DELAY);
+
+		return true;
+	}
+
+	return false;
+}
+
+static void next_to_expired(struct l_timeout *timeout, void *user_data)
+{
+	struct tcp_connect *conn = user_data;
+
+	/* Previous attempts keep running */
+	attempt_start(conn);
+}
+
+static void connect_to_expired(struct l_timeout *timeout, void *user_data)
+{
+	struct tcp_connect *conn = user_data;
+
+	connect_finish(conn, -ETIMEDOUT);
+}
+
+static void connect_start(struct tcp_link *link)
+{
+	struct tcp_connect *conn;
+
+	conn = l_new(struct tcp_connect, 1);
+	conn->link = link;
+	conn->next = 0;
+	conn->err = -EHOSTUNREACH;
+	conn->attempt_list = l_queue_new();
+	conn->next_to = l_timeout_create_ms(ATTEMPT_DELAY, next_to_expired,
+					    conn, NULL);
+	conn->timeout = l_timeout_create_ms(CONNECT_TIMEOUT,
+					    connect_to_expired, conn, NULL);
+
+	link->conn = conn;
+
+	if (!attempt_start(conn))
+		connect_finish(conn, conn->err);
+}
+
+/* Candidates alternate between families, starting with the preferred */
+static void link_set_addr(struct tcp_link *link, const struct addrinfo *res,
+			  uint64_t until)
+{
+	const struct addrinfo *ai[2];
+	int family[2];
+	int i = 0;
+
+	link->naddr = 0;
+	link->resolved_until = until;
+
+	if (!res)
+		return;
+
+	family[0] = res->ai_family;
+	family[1] = (res->ai_family == AF_INET6 ? AF_INET : AF_INET6);
+	ai[0] = res;
+	ai[1] = res;
+
+	while (link->naddr < ADDR_MAX) {
+		/* Next candidate of the current family */
+		while (ai[i] && (ai[i]->ai_family != family[i] ||
+			ai[i]->ai_addrlen > sizeof(struct sockaddr_storage)))
+			ai[i] = ai[i]->ai_next;
+
+		if (!ai[i]) {
+			if (!ai[!i])
+				break;
+
+			i = !i;
+			continue;
+		}
+
+		link->addr[link->naddr].len = ai[i]->ai_addrlen;
+		memcpy(&link->addr[link->naddr].sa, ai[i]->ai_addr,
+		       ai[i]->ai_addrlen);
+		link->naddr++;
+
+		ai[i] = ai[i]->ai_next;
+		i = !i;
+	}
+}
+
+static int resolve(const char *hostname, const char *port, int flags,
+		   struct addrinfo **res)
+{
+	struct addrinfo hints;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = flags;
+
+	return getaddrinfo(hostname, port, &hints, res);
+}
+
+/* Runs at the worker thread */
+static void resolve_exec(void *user_data)
+{
+	struct tcp_resolve *req = user_data;
+
+	if (resolve(req->hostname, req->port, AI_ADDRCONFIG, &req->res) != 0) {
+		req->res = NULL;
+		req->err = -EHOSTUNREACH;
+	}
+}
+
+static void resolve_done(void *user_data)
+{
+	struct tcp_resolve *req = user_data;
+	struct tcp_link *link = req->link;
+
+	if (req->err < 0) {
+		link->connecting = false;
+		l_info("resolve(%s): failed", link->key);
+		l_queue_foreach(link->ctx_list, ctx_connected,
+				L_INT_TO_PTR(req->err));
+		return;
+	}
+
+	link_set_addr(link, req->res, l_time_now() +
+		      RESOLVE_TTL * (uint64_t) 1000000);
+	connect_start(link);
+}
+
+static void resolve_free(void *user_data)
+{
+	struct tcp_resolve *req = user_data;
+
+	if (req->res)
+		freeaddrinfo(req->res);
+
+	l_free(req->hostname);
+	l_free(req->port);
+	l_free(req);
+}
+
+static struct tcp_link *link_new(const char *hostname, const char *port)
+{
+	struct tcp_link *link;
+	int prio;
+
+	link = l_new(struct tcp_link, 1);
+	link->refs = 0;
+	link->key = l_strdup_printf("%s:%s", hostname, port);
+	link->hostname = l_strdup(hostname);
+	link->port = l_strdup(port);
+	link->io = NULL;
+	link->worker = worker_new();
+	link->connecting = false;
+	link->conn = NULL;
+	link->naddr = 0;
+	link->resolved_until = 0;
+	link->ctx_list = l_queue_new();
+	link->inflight_list = l_queue_new();
+
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++) {
+		link->pending_list[prio] = l_queue_new();
+		link->delay[prio] = 0;
+	}
+
+	link->next_id = 1;
+	link->next_tid = 0;
+
+	if (!link_map)
+		link_map = l_hashmap_string_new();
+
+	l_hashmap_insert(link_map, link->key, link);
+
+	return link;
+}
+
+static struct tcp_link *link_ref(struct tcp_link *link)
+{
+	__sync_fetch_and_add(&link->refs, 1);
+
+	return link;
+}
+
+static void link_unref(struct tcp_link *link)
+{
+	int prio;
+
+	if (__sync_sub_and_fetch(&link->refs, 1))
+		return;
+
+	l_info("tcp(%s): releasing link", link->key);
+
+	l_hashmap_remove(link_map, link->key);
+
+	/* Pending name resolution: 'done' won't be called */
+	worker_destroy(link->worker);
+
+	if (link->conn)
+		connect_free(link->conn);
+
+	if (link->io) {
+		l_io_set_disconnect_handler(link->io, NULL, NULL, NULL);
+		l_io_destroy(link->io);
+	}
+
+	/* Transactions have been cancelled by their owners */
+	l_queue_destroy(link->inflight_list, NULL);
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++)
+		l_queue_destroy(link->pending_list[prio], NULL);
+	l_queue_destroy(link->ctx_list, NULL);
+
+	l_free(link->key);
+	l_free(link->hostname);
+	l_free(link->port);
+	l_free(link);
+}
+
+static void *create(const char *url, uint8_t id,
+		    modbus_driver_func_t disconnected_cb, void *user_data)
 {
+	struct tcp_link *link;
+	struct tcp_ctx *ctx;
 	char hostname[128];
 	char port[8];
+	char *key;
 
 	memset(hostname, 0, sizeof(hostname));
 	memset(port, 0, sizeof(port));
@@ -48,56 +930,264 @@ static modbus_t *create(const char *url)
 		return NULL;
 	}
 
-	l_info("RTU: %s", url);
+	l_info("TCP: %s", url);
+
+	/* Slaves behind the same gateway share the connection */
+	key = l_strdup_printf("%s:%s", hostname, port);
+	link = (link_map ? l_hashmap_lookup(link_map, key) : NULL);
+	l_free(key);
+
+	if (!link)
+		link = link_new(hostname, port);
+
+	ctx = l_new(struct tcp_ctx, 1);
+	ctx->link = link_ref(link);
+	ctx->unit = id;
+	ctx->connected = false;
+	ctx->disconnected_cb = disconnected_cb;
+	ctx->user_data = user_data;
+	ctx->connect_cb = NULL;
+	ctx->connect_data = NULL;
+	rtt_init(&ctx->rtt);
+
+	l_queue_push_tail(link->ctx_list, ctx);
+
+	return ctx;
+}
+
+static bool txn_owner_cmp(const void *a, const void *b)
+{
+	const struct txn *txn = a;
+
+	return (txn->ctx == b ? true : false);
+}
+
+static void destroy(void *user_data)
+{
+	struct tcp_ctx *ctx = user_data;
+	struct tcp_link *link = ctx->link;
+	struct txn *txn;
+	int prio;
+
+	/* Release transactions owned by this slave only */
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++)
+		while ((txn = l_queue_remove_if(link->pending_list[prio],
+						txn_owner_cmp, ctx)))
+			txn_free(txn);
+
+	while ((txn = l_queue_remove_if(link->inflight_list,
+					txn_owner_cmp, ctx))) {
+		rx_detach(link, txn);
+		txn_free(txn);
+	}
+
+	l_queue_remove(link->ctx_list, ctx);
+	l_free(ctx);
+
+	tcp_send_pending(link);
+	link_unref(link);
+}
+
+static int tcp_connect(void *user_data, modbus_driver_func_t func,
+		       void *func_data)
+{
+	struct tcp_ctx *ctx = user_data;
+	struct tcp_link *link = ctx->link;
+	struct tcp_resolve *req;
+	struct addrinfo *res;
+
+	if (ctx->connected)
+		return -EISCONN;
+
+	if (ctx->connect_cb)
+		return -EALREADY;
+
+	ctx->connect_cb = func;
+	ctx->connect_data = func_data;
+
+	/* Link already connected by another slave */
+	if (link->io) {
+		ctx_connected(ctx, L_INT_TO_PTR(0));
+		return 0;
+	}
+
+	if (link->connecting)
+		return 0;
+
+	link->connecting = true;
+
+	/* Cached addresses */
+	if (link->naddr && l_time_now() < link->resolved_until) {
+		connect_start(link);
+		return 0;
+	}
+
+	/* Numeric address: doesn't block, never expires */
+	if (resolve(link->hostname, link->port,
+		    AI_NUMERICHOST | AI_NUMERICSERV, &res) == 0) {
+		link_set_addr(link, res, UINT64_MAX);
+		freeaddrinfo(res);
+		connect_start(link);
+		return 0;
+	}
+
+	req = l_new(struct tcp_resolve, 1);
+	req->link = link;
+	req->hostname = l_strdup(link->hostname);
+	req->port = l_strdup(link->port);
+	req->res = NULL;
+	req->err = 0;
+
+	if (!worker_submit(link->worker, resolve_exec,
+			   resolve_done, req, resolve_free)) {
+		link->connecting = false;
+		ctx->connect_cb = NULL;
+		resolve_free(req);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static unsigned int submit(struct tcp_ctx *ctx, uint8_t fc, uint16_t addr,
+			   uint16_t nb, enum modbus_priority prio,
+			   void *out, modbus_driver_func_t func,
+			   void *user_data,
+			   modbus_driver_destroy_func_t destroy)
+{
+	struct tcp_link *link = ctx->link;
+	struct txn *txn;
+
+	if (!ctx->connected || !link->io || prio >= MODBUS_PRIORITY_MAX)
+		return 0;
+
+	txn = l_new(struct txn, 1);
+	txn->link = link;
+	txn->ctx = ctx;
+	txn->id = link->next_id++;
+	txn->unit = ctx->unit;
+	txn->fc = fc;
+	txn->prio = prio;
+	txn->queued_at = l_time_now();
+	txn->sent_at = 0;
+	txn->addr = addr;
+	txn->nb = nb;
+	txn->out = out;
+	txn->func = func;
+	txn->user_data = user_data;
+	txn->destroy = destroy;
 
-	return modbus_new_tcp_pi(hostname, port);
+	/* Skip zero: invalid id */
+	if (link->next_id == 0)
+		link->next_id = 1;
+
+	l_queue_push_tail(link->pending_list[prio], txn);
+	tcp_send_pending(link);
+
+	return txn->id;
 }
 
-static void destroy(modbus_t *ctx)
+static unsigned int read_bits(void *ctx, enum modbus_table table,
+			      uint16_t addr, uint16_t nb,
+			      enum modbus_priority prio, uint8_t *out,
+			      modbus_driver_func_t func,
+			      void *user_data,
+			      modbus_driver_destroy_func_t destroy)
 {
-	modbus_close(ctx);
-	modbus_free(ctx);
+	if (nb == 0 || nb > MODBUS_MAX_READ_BITS ||
+	    !MODBUS_TABLE_IS_BITS(table))
+		return 0;
+
+	return submit(ctx, table == MODBUS_TABLE_COILS ?
+		      FC_READ_COILS : FC_READ_DISCRETE_INPUTS,
+		      addr, nb, prio, out, func, user_data, destroy);
 }
 
-static int read_bool(modbus_t *ctx, uint16_t addr, bool *out)
+static unsigned int read_registers(void *ctx, enum modbus_table table,
+				   uint16_t addr, uint16_t nb,
+				   enum modbus_priority prio, uint16_t *out,
+				   modbus_driver_func_t func,
+				   void *user_data,
+				   modbus_driver_destroy_func_t destroy)
 {
-	uint8_t val_u8 = 0;
-	int ret;
+	if (nb == 0 || nb > MODBUS_MAX_READ_REGISTERS ||
+	    MODBUS_TABLE_IS_BITS(table) || table >= MODBUS_TABLE_MAX)
+		return 0;
 
-	ret = modbus_read_input_bits(ctx, addr, 1, &val_u8);
-	if (ret > 0)
-		*out = (val_u8 ? true : false);
+	return submit(ctx, table == MODBUS_TABLE_INPUT_REGISTERS ?
+		      FC_READ_INPUT_REGISTERS : FC_READ_HOLDING_REGISTERS,
+		      addr, nb, prio, out, func, user_data, destroy);
+}
 
-	return ret;
+static void cancel(void *user_data, unsigned int id)
+{
+	struct tcp_ctx *ctx = user_data;
+	struct tcp_link *link = ctx->link;
+	struct txn *txn;
+	int prio;
+
+	for (prio = 0; prio < MODBUS_PRIORITY_MAX; prio++) {
+		txn = l_queue_remove_if(link->pending_list[prio], id_cmp,
+					L_UINT_TO_PTR(id));
+		if (txn) {
+			txn_free(txn);
+			return;
+		}
+	}
+
+	/* Already sent: late response is discarded */
+	txn = l_queue_remove_if(link->inflight_list, id_cmp,
+				L_UINT_TO_PTR(id));
+	if (!txn)
+		return;
+
+	rx_detach(link, txn);
+	txn_free(txn);
+
+	tcp_send_pending(link);
 }
 
-static int read_byte(modbus_t *ctx, uint16_t addr, uint8_t *out)
+static uint32_t queue_delay(void *user_data, enum modbus_priority prio)
 {
-	return modbus_read_input_bits(ctx, addr, 8, out);
+	struct tcp_ctx *ctx = user_data;
+
+	if (prio >= MODBUS_PRIORITY_MAX)
+		return 0;
+
+	return ctx->link->delay[prio];
 }
 
-static int read_u16(modbus_t *ctx, uint16_t addr, uint16_t *out)
+static void set_timeout(void *user_data, uint32_t ms)
 {
-	return modbus_read_registers(ctx, addr, 1, out);
+	struct tcp_ctx *ctx = user_data;
+
+	rtt_set_timeout(&ctx->rtt, ms);
 }
 
-static int read_u32(modbus_t *ctx, uint16_t addr, uint32_t *out)
+static uint32_t get_timeout(void *user_data)
 {
-	return modbus_read_registers(ctx, addr, 2, (uint16_t *) out);
+	struct tcp_ctx *ctx = user_data;
+
+	return rtt_get_timeout(&ctx->rtt);
 }
 
-static int read_u64(modbus_t *ctx, uint16_t addr, uint64_t *out)
+static uint32_t get_rtt(void *user_data)
 {
-	return modbus_read_registers(ctx, addr, 4, (uint16_t *) out);
+	struct tcp_ctx *ctx = user_data;
+
+	return ctx->rtt.srtt;
 }
 
 struct modbus_driver tcp = {
 	.name = "tcp",
 	.create = create,
 	.destroy = destroy,
-	.read_bool = read_bool,
-	.read_byte = read_byte,
-	.read_u16 = read_u16,
-	.read_u32 = read_u32,
-	.read_u64 = read_u64,
+	.connect = tcp_connect,
+	.read_bits = read_bits,
+	.read_registers = read_registers,
+	.cancel = cancel,
+	.queue_delay = queue_delay,
+	.set_timeout = set_timeout,
+	.get_timeout = get_timeout,
+	.get_rtt = get_rtt,
 };
@@ -0,0 +1,325 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <ell/ell.h>
+
+#include "timer.h"
+
+/* 4 levels of 64 slots at 1 ms: up to ~4.6 hours ahead */
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_SPAN	((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+struct wheel {
+	struct timer_node slot[WHEEL_LEVELS][WHEEL_SIZE];	/* List heads */
+	uint64_t used[WHEEL_LEVELS];	/* Non-empty slots bitmap */
+	uint64_t now;			/* Last processed tick */
+	uint64_t armed;			/* Tick the timeout expires */
+	bool running;			/* Expiring timers */
+	struct l_timeout *timeout;
+};
+
+static struct wheel wheel;
+
+static uint64_t tick_now(void)
+{
+	return l_time_now() / 1000;
+}
+
+static void list_init(struct timer_node *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static bool list_empty(const struct timer_node *head)
+{
+	return head->next == head;
+}
+
+static void list_add_tail(struct timer_node *head, struct timer_node *node)
+{
+	node->prev = head->prev;
+	node->next = head;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+static void list_unlink(struct timer_node *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->next = NULL;
+	node->prev = NULL;
+}
+
+/* Move every node of 'from' to 'to' */
+static void list_splice(struct timer_node *from, struct timer_node *to)
+{
+	list_init(to);
+
+	if (list_empty(from))
+		return;
+
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	list_init(from);
+}
+
+static void slot_add(int level, int index, struct timer_node *node)
+{
+	list_add_tail(&wheel.slot[level][index], node);
+	wheel.used[level] |= (uint64_t) 1 << index;
+}
+
+/* Level selected by the distance to the deadline */
+static void wheel_insert(struct timer_node *node)
+{
+	uint64_t delta;
+	int level;
+	int shift;
+
+	/* Beyond the wheel span: re-inserted when cascading */
+	if (node->expire - wheel.now >= WHEEL_SPAN)
+		delta = WHEEL_SPAN - 1;
+	else
+		delta = node->expire - wheel.now;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < ((uint64_t) 1 << (WHEEL_BITS * (level + 1))))
+			break;
+
+	shift = level * WHEEL_BITS;
+
+	slot_add(level, ((wheel.now + delta) >> shift) & WHEEL_MASK, node);
+}
+
+/* Next tick requiring processing: expiring or cascading a slot */
+static uint64_t wheel_next(void)
+{
+	uint64_t next = UINT64_MAX;
+	uint64_t base;
+	uint64_t mask;
+	uint64_t tick;
+	int level;
+	int shift;
+	int cur;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		if (!wheel.used[level])
+			continue;
+
+		shift = level * WHEEL_BITS;
+		base = wheel.now >> shift;
+		cur = base & WHEEL_MASK;
+
+		/* Slots after the current one, otherwise next rotation */
+		mask = wheel.used[level] & ~((2ULL << cur) - 1);
+		if (mask)
+			tick = (base & ~(uint64_t) WHEEL_MASK) |
+				__builtin_ctzll(mask);
+		else
+			tick = ((base & ~(uint64_t) WHEEL_MASK) |
+				__builtin_ctzll(wheel.used[level])) +
+				WHEEL_SIZE;
+
+		tick <<= shift;
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+static void wheel_cascade(int level, int index)
+{
+	struct timer_node list;
+	struct timer_node *node;
+
+	list_splice(&wheel.slot[level][index], &list);
+	wheel.used[level] &= ~((uint64_t) 1 << index);
+
+	while (!list_empty(&list)) {
+		node = list.next;
+		list_unlink(node);
+		wheel_insert(node);
+	}
+}
+
+static void wheel_expire(int index)
+{
+	struct timer_node list;
+	struct timer_node *node;
+
+	list_splice(&wheel.slot[0][index], &list);
+	wheel.used[0] &= ~((uint64_t) 1 << index);
+
+	/* Callbacks may cancel or re-arm any node, including listed ones */
+	while (!list_empty(&list)) {
+		node = list.next;
+		list_unlink(node);
+		node->func(node->user_data);
+	}
+}
+
+static void wheel_schedule(void)
+{
+	uint64_t next = wheel_next();
+	uint64_t now;
+
+	wheel.armed = next;
+	if (next == UINT64_MAX)
+		return;
+
+	now = tick_now();
+	l_timeout_modify_ms(wheel.timeout, next > now ? next - now : 1);
+}
+
+static void wheel_advance(uint64_t target)
+{
+	uint64_t next;
+	int level;
+	int shift;
+
+	while (wheel.now < target) {
+		next = wheel_next();
+		if (next > target) {
+			/* Nothing happens in between: jump */
+			wheel.now = target;
+			break;
+		}
+
+		wheel.now = next;
+
+		/* Upper levels first: nodes may cascade more than once */
+		for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+			shift = level * WHEEL_BITS;
+			if (next & (((uint64_t) 1 << shift) - 1))
+				continue;
+
+			wheel_cascade(level, (next >> shift) & WHEEL_MASK);
+		}
+
+		wheel_expire(next & WHEEL_MASK);
+	}
+}
+
+static void timeout_expired(struct l_timeout *timeout, void *user_data)
+{
+	wheel.running = true;
+	wheel_advance(tick_now());
+	wheel.running = false;
+
+	wheel_schedule();
+}
+
+int timer_start(void)
+{
+	int level;
+	int i;
+
+	l_info("Starting timer ...");
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		for (i = 0; i < WHEEL_SIZE; i++)
+			list_init(&wheel.slot[level][i]);
+
+		wheel.used[level] = 0;
+	}
+
+	wheel.now = tick_now();
+	wheel.armed = UINT64_MAX;
+	wheel.running = false;
+
+	/* Armed on demand */
+	wheel.timeout = l_timeout_create_ms(0, timeout_expired, NULL, NULL);
+	if (!wheel.timeout)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void timer_stop(void)
+{
+	l_timeout_remove(wheel.timeout);
+	wheel.timeout = NULL;
+}
+
+void timer_init(struct timer_node *node, timer_func_t func, void *user_data)
+{
+	node->next = NULL;
+	node->prev = NULL;
+	node->expire = 0;
+	node->func = func;
+	node->user_data = user_data;
+}
+
+/* deadline: l_time_now() based, in microseconds */
+void timer_arm(struct timer_node *node, uint64_t deadline)
+{
+	/* Round up: never before the deadline */
+	uint64_t expire = (deadline + 999) / 1000;
+
+	timer_cancel(node);
+
+	/* Idle wheel: catch up with the clock */
+	if (!wheel.running && wheel.armed == UINT64_MAX)
+		wheel.now = tick_now();
+
+	/* Already expired: next tick */
+	node->expire = (expire > wheel.now ? expire : wheel.now + 1);
+	wheel_insert(node);
+
+	/* Re-armed when the running expiration finishes */
+	if (wheel.running || node->expire >= wheel.armed)
+		return;
+
+	wheel_schedule();
+}
+
+void timer_cancel(struct timer_node *node)
+{
+	if (!timer_pending(node))
+		return;
+
+	/*
+	 * Slot bit and timeout are left untouched: emptied slots are
+	 * cleared when reached, spurious wakeups are harmless.
+	 */
+	list_unlink(node);
+}
+
+bool timer_pending(const struct timer_node *node)
+{
+	return node->next != NULL;
+}
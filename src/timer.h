@@ -0,0 +1,46 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Hierarchical timer wheel: every timer of the process shares a single
+ * l_timeout (one timerfd). Nodes are embedded in the owner object, so
+ * arming, re-arming and cancelling don't allocate and are O(1).
+ * Resolution is 1 ms: timers never expire before their deadline.
+ */
+
+typedef void (*timer_func_t) (void *user_data);
+
+/* Embedded at the owner object: fields are private */
+struct timer_node {
+	struct timer_node *next;
+	struct timer_node *prev;
+	uint64_t expire;		/* Tick (ms) */
+	timer_func_t func;
+	void *user_data;
+};
+
+int timer_start(void);
+void timer_stop(void);
+
+void timer_init(struct timer_node *node, timer_func_t func, void *user_data);
+void timer_arm(struct timer_node *node, uint64_t deadline);
+void timer_cancel(struct timer_node *node);
+bool timer_pending(const struct timer_node *node);
@@ -0,0 +1,377 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <ell/ell.h>
+
+#include "worker.h"
+
+/* Idle threads exit after 60 seconds */
+#define WORKER_IDLE_TIMEOUT	60
+
+struct worker {
+	int refs;
+	struct l_queue *job_list;	/* Pending jobs */
+	bool busy;			/* Job running on a pool thread */
+	bool queued;			/* Waiting at ready_list */
+	bool destroyed;			/* Don't call 'done' anymore */
+};
+
+struct job {
+	struct worker *worker;
+	worker_func_t func;
+	worker_func_t done;
+	worker_destroy_func_t destroy;
+	void *user_data;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t exit_cond = PTHREAD_COND_INITIALIZER;
+
+/* Protected by 'lock' */
+static struct l_queue *ready_list;	/* Workers with pending jobs */
+static struct l_queue *done_list;	/* Jobs to be completed */
+static int max_threads;
+static int threads;
+static int idle_threads;
+static bool quit;
+
+/* Main loop only */
+static struct l_io *wakeup_io;
+static bool stopping;
+
+static struct worker *worker_ref(struct worker *worker)
+{
+	__sync_fetch_and_add(&worker->refs, 1);
+
+	return worker;
+}
+
+static void worker_unref(struct worker *worker)
+{
+	if (__sync_sub_and_fetch(&worker->refs, 1))
+		return;
+
+	l_queue_destroy(worker->job_list, NULL);
+	l_free(worker);
+}
+
+static void job_free(void *data)
+{
+	struct job *job = data;
+
+	if (job->destroy)
+		job->destroy(job->user_data);
+
+	worker_unref(job->worker);
+	l_free(job);
+}
+
+static void job_complete(void *data, void *user_data)
+{
+	struct job *job = data;
+
+	if (!stopping && !job->worker->destroyed && job->done)
+		job->done(job->user_data);
+
+	job_free(job);
+}
+
+static void wakeup_post(void)
+{
+	uint64_t u64 = 1;
+
+	if (write(l_io_get_fd(wakeup_io), &u64, sizeof(u64)) < 0)
+		return;
+}
+
+static struct l_queue *done_list_steal(void)
+{
+	struct l_queue *list;
+
+	pthread_mutex_lock(&lock);
+	list = done_list;
+	done_list = l_queue_new();
+	pthread_mutex_unlock(&lock);
+
+	return list;
+}
+
+static bool wakeup_read_cb(struct l_io *io, void *user_data)
+{
+	struct l_queue *list;
+	uint64_t u64;
+
+	if (read(l_io_get_fd(io), &u64, sizeof(u64)) < 0 && errno != EAGAIN)
+		return false;
+
+	/* 'done' callbacks may submit new jobs */
+	list = done_list_steal();
+	l_queue_foreach(list, job_complete, NULL);
+	l_queue_destroy(list, NULL);
+
+	return true;
+}
+
+static void *thread_run(void *user_data)
+{
+	struct worker *worker;
+	struct job *job;
+	struct timespec ts;
+
+	pthread_mutex_lock(&lock);
+
+	for (;;) {
+		while (!quit && l_queue_isempty(ready_list)) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += WORKER_IDLE_TIMEOUT;
+
+			idle_threads++;
+			if (pthread_cond_timedwait(&ready_cond,
+						   &lock, &ts) == ETIMEDOUT &&
+			    l_queue_isempty(ready_list)) {
+				idle_threads--;
+				goto done;
+			}
+			idle_threads--;
+		}
+
+		if (quit)
+			break;
+
+		worker = l_queue_pop_head(ready_list);
+		worker->queued = false;
+		worker->busy = true;
+		job = l_queue_pop_head(worker->job_list);
+
+		pthread_mutex_unlock(&lock);
+
+		job->func(job->user_data);
+
+		pthread_mutex_lock(&lock);
+
+		worker->busy = false;
+		if (!l_queue_isempty(worker->job_list)) {
+			/* Keep ordering: next job of this worker */
+			l_queue_push_tail(ready_list, worker);
+			worker->queued = true;
+		}
+
+		l_queue_push_tail(done_list, job);
+		wakeup_post();
+	}
+
+done:
+	threads--;
+	pthread_cond_broadcast(&exit_cond);
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+static int thread_spawn(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int err;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	err = pthread_create(&thread, &attr, thread_run, NULL);
+	pthread_attr_destroy(&attr);
+	if (err)
+		return -err;
+
+	threads++;
+
+	return 0;
+}
+
+int worker_start(int max)
+{
+	int fd;
+
+	l_info("Starting worker ...");
+
+	fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0)
+		return -errno;
+
+	wakeup_io = l_io_new(fd);
+	l_io_set_close_on_destroy(wakeup_io, true);
+	l_io_set_read_handler(wakeup_io, wakeup_read_cb, NULL, NULL);
+
+	ready_list = l_queue_new();
+	done_list = l_queue_new();
+	max_threads = (max > 0 ? max : 1);
+	threads = 0;
+	idle_threads = 0;
+	quit = false;
+	stopping = false;
+
+	return 0;
+}
+
+void worker_stop(void)
+{
+	struct l_queue *list;
+
+	pthread_mutex_lock(&lock);
+	quit = true;
+	pthread_cond_broadcast(&ready_cond);
+
+	/* Running jobs can't be interrupted: wait until they finish */
+	while (threads > 0)
+		pthread_cond_wait(&exit_cond, &lock);
+
+	pthread_mutex_unlock(&lock);
+
+	/* Release completed jobs without calling 'done' */
+	stopping = true;
+	list = done_list_steal();
+	l_queue_foreach(list, job_complete, NULL);
+	l_queue_destroy(list, NULL);
+
+	l_queue_destroy(ready_list, NULL);
+	l_queue_destroy(done_list, NULL);
+	l_io_destroy(wakeup_io);
+	wakeup_io = NULL;
+}
+
+struct worker *worker_new(void)
+{
+	struct worker *worker;
+
+	worker = l_new(struct worker, 1);
+	worker->job_list = l_queue_new();
+	worker->busy = false;
+	worker->queued = false;
+	worker->destroyed = false;
+
+	return worker_ref(worker);
+}
+
+void worker_destroy(struct worker *worker)
+{
+	if (unlikely(!worker))
+		return;
+
+	worker_flush(worker);
+
+	/* Running job keeps a reference: 'done' won't be called */
+	worker->destroyed = true;
+	worker_unref(worker);
+}
+
+void worker_flush(struct worker *worker)
+{
+	struct l_queue *list;
+
+	if (unlikely(!worker))
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	list = worker->job_list;
+	worker->job_list = l_queue_new();
+
+	if (worker->queued) {
+		l_queue_remove(ready_list, worker);
+		worker->queued = false;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	l_queue_destroy(list, job_free);
+}
+
+bool worker_submit(struct worker *worker, worker_func_t func,
+		   worker_func_t done, void *user_data,
+		   worker_destroy_func_t destroy)
+{
+	struct job *job;
+
+	if (unlikely(!worker || !func || !wakeup_io))
+		return false;
+
+	job = l_new(struct job, 1);
+	job->worker = worker_ref(worker);
+	job->func = func;
+	job->done = done;
+	job->destroy = destroy;
+	job->user_data = user_data;
+
+	pthread_mutex_lock(&lock);
+
+	l_queue_push_tail(worker->job_list, job);
+
+	if (!worker->busy && !worker->queued) {
+		l_queue_push_tail(ready_list, worker);
+		worker->queued = true;
+	}
+
+	/*
+	 * Grow on demand: a blocked slave must not delay the others. Idle
+	 * threads are only accounted once awake, so signalled ones still
+	 * count: spawn whenever ready workers outnumber them.
+	 */
+	if ((int) l_queue_length(ready_list) > idle_threads &&
+	    threads < max_threads && thread_spawn() < 0) {
+		l_error("worker: can't create thread");
+
+		/* No thread to run it: fail instead of queueing forever */
+		if (threads == 0)
+			goto unqueue;
+	}
+
+	pthread_cond_signal(&ready_cond);
+
+	pthread_mutex_unlock(&lock);
+
+	return true;
+
+unqueue:
+	l_queue_remove(worker->job_list, job);
+
+	if (worker->queued && l_queue_isempty(worker->job_list)) {
+		l_queue_remove(ready_list, worker);
+		worker->queued = false;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	/* Caller keeps 'user_data' */
+	worker_unref(job->worker);
+	l_free(job);
+
+	return false;
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Thread pool to run blocking I/O outside of the main loop. Jobs
+ * submitted to the same worker run sequentially in submission order,
+ * jobs of different workers run concurrently. 'func' runs on a pool
+ * thread and must not call ell APIs. 'done' and 'destroy' run on the
+ * main loop. 'destroy' is always called, even if the job is flushed,
+ * unless worker_submit() fails: 'user_data' is left to the caller.
+ */
+
+typedef void (*worker_func_t) (void *user_data);
+typedef void (*worker_destroy_func_t) (void *user_data);
+
+struct worker;
+
+int worker_start(int max_threads);
+void worker_stop(void);
+
+struct worker *worker_new(void);
+void worker_destroy(struct worker *worker);
+void worker_flush(struct worker *worker);
+bool worker_submit(struct worker *worker, worker_func_t func,
+		   worker_func_t done, void *user_data,
+		   worker_destroy_func_t destroy);
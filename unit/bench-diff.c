@@ -0,0 +1,102 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Change detection timing: scalar loop vs vectorized kernel, per block
+ * length. Not a test: timings depend on the host, run it by hand.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <time.h>
+
+#include <ell/ell.h>
+
+#include "src/image.h"
+
+#define BENCH_RUNS	2000000
+
+/* One spare register: readings alternate between two offsets */
+#define BENCH_LEN	(64 + 1)
+
+typedef uint64_t (*diff_func_t) (const uint16_t *old, const uint16_t *new,
+				 unsigned int n);
+
+static uint64_t time_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * (uint64_t) 1000000000 + ts.tv_nsec;
+}
+
+/* Few changes: most readings repeat the previous values */
+static void fill(uint16_t *old, uint16_t *new, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		old[i] = l_getrandom_uint32();
+		new[i] = (l_getrandom_uint32() % 4 ? old[i] :
+			  (uint16_t) l_getrandom_uint32());
+	}
+}
+
+/* Picoseconds per call */
+static uint64_t bench(diff_func_t func, const uint16_t *old,
+		      const uint16_t *new, unsigned int n)
+{
+	volatile uint64_t sink = 0;
+	uint64_t start;
+	unsigned int i;
+
+	start = time_now();
+	for (i = 0; i < BENCH_RUNS; i++)
+		sink += func(old, new + (i & 1), n);
+
+	(void) sink;
+
+	return (time_now() - start) / (BENCH_RUNS / 1000);
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int lengths[] = { 7, 13, 31, 61, 64 };
+	uint16_t old[BENCH_LEN];
+	uint16_t new[BENCH_LEN];
+	unsigned int i;
+
+	fill(old, new, BENCH_LEN);
+
+	for (i = 0; i < L_ARRAY_SIZE(lengths); i++)
+		printf("n=%-2u scalar %6llu ps vector %6llu ps\n",
+		       lengths[i],
+		       (unsigned long long) bench(image_diff_registers_scalar,
+						old, new, lengths[i]),
+		       (unsigned long long) bench(image_diff_registers,
+						old, new, lengths[i]));
+
+	return 0;
+}
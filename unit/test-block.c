@@ -0,0 +1,470 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <ell/ell.h>
+
+#include "src/driver.h"
+#include "src/source.h"
+#include "src/devlimits.h"
+#include "src/image.h"
+#include "src/block.h"
+
+/* Planner view of a source: no D-Bus object nor storage */
+struct source {
+	const char *sig;
+	int table;
+	uint16_t address;
+	uint16_t interval;
+	unsigned int notified;
+};
+
+const char *source_get_signature(const struct source *source)
+{
+	return source->sig;
+}
+
+int source_get_table(const struct source *source)
+{
+	return source->table;
+}
+
+uint16_t source_get_address(const struct source *source)
+{
+	return source->address;
+}
+
+uint16_t source_get_interval(const struct source *source)
+{
+	return source->interval;
+}
+
+uint16_t source_get_max_interval(const struct source *source)
+{
+	return 0;
+}
+
+bool source_get_phase_aligned(const struct source *source)
+{
+	return false;
+}
+
+int source_get_priority(const struct source *source)
+{
+	return MODBUS_PRIORITY_NORMAL;
+}
+
+const char *source_get_snapshot(const struct source *source)
+{
+	return NULL;
+}
+
+int source_get_trigger_table(const struct source *source)
+{
+	return source->table;
+}
+
+uint16_t source_get_trigger(const struct source *source)
+{
+	return 0xffff;
+}
+
+uint64_t source_get_trigger_mask(const struct source *source)
+{
+	return 0;
+}
+
+const char *source_priority_to_string(int prio)
+{
+	return "normal";
+}
+
+const char *source_table_to_string(int table)
+{
+	return "holding-registers";
+}
+
+void source_update_timing(struct source *source, uint32_t jitter,
+			  bool overrun)
+{
+}
+
+void source_notify(struct source *source)
+{
+	source->notified++;
+}
+
+#define HR	MODBUS_TABLE_HOLDING_REGISTERS
+
+struct test_plan {
+	struct l_queue *source_list;
+	struct devlimits *limits;
+	struct image *image;
+	char filename[32];
+};
+
+static struct test_plan *plan_new(struct source *sources, unsigned int len)
+{
+	struct test_plan *plan = l_new(struct test_plan, 1);
+	unsigned int i;
+	int fd;
+
+	plan->source_list = l_queue_new();
+	for (i = 0; i < len; i++)
+		l_queue_push_tail(plan->source_list, &sources[i]);
+
+	/* Learned limits are stored: scratch device.conf */
+	snprintf(plan->filename, sizeof(plan->filename),
+		 "/tmp/test-block-XXXXXX");
+	fd = mkstemp(plan->filename);
+	assert(fd >= 0);
+	close(fd);
+
+	plan->limits = devlimits_new(plan->filename);
+	plan->image = image_new();
+
+	return plan;
+}
+
+static void plan_free(struct test_plan *plan)
+{
+	image_free(plan->image);
+	devlimits_free(plan->limits);
+	unlink(plan->filename);
+	l_queue_destroy(plan->source_list, NULL);
+	l_free(plan);
+}
+
+static bool block_match(const void *a, const void *b)
+{
+	return (block_get_address(a) == L_PTR_TO_UINT(b));
+}
+
+static struct block *find_block(struct l_queue *blocks, uint16_t address)
+{
+	return l_queue_find(blocks, block_match, L_UINT_TO_PTR(address));
+}
+
+/* Image covering the blocks, as the slave does after planning */
+static void plan_image(struct test_plan *plan, struct l_queue *blocks)
+{
+	const struct l_queue_entry *entry;
+	uint32_t first = UINT32_MAX;
+	uint32_t end = 0;
+	struct block *block;
+
+	for (entry = l_queue_get_entries(blocks); entry; entry = entry->next) {
+		block = entry->data;
+		if (block_get_address(block) < first)
+			first = block_get_address(block);
+		if (block_get_address(block) + block_get_size(block) > end)
+			end = block_get_address(block) + block_get_size(block);
+	}
+
+	image_resize(plan->image, HR, first, end - first);
+}
+
+static void block_set(struct block *block, uint16_t address, uint16_t value)
+{
+	uint16_t *regs = block_get_buffer(block);
+
+	regs[address - block_get_address(block)] = value;
+}
+
+static void test_plan_gap(const void *data)
+{
+	struct source sources[] = {
+		{ "q", HR, 0x10, 1000 },
+		{ "q", HR, 0x12, 1000 },
+		{ "u", HR, 0x20, 1000 },
+	};
+	struct test_plan *plan = plan_new(sources, L_ARRAY_SIZE(sources));
+	struct l_queue *blocks;
+
+	/* Contiguous addresses only */
+	blocks = block_plan(plan->source_list, 0, plan->limits);
+	assert(l_queue_length(blocks) == 3);
+	l_queue_destroy(blocks, block_destroy);
+
+	/* One unused register merged */
+	blocks = block_plan(plan->source_list, 1, plan->limits);
+	assert(l_queue_length(blocks) == 2);
+	assert(block_get_size(find_block(blocks, 0x10)) == 3);
+	assert(block_get_size(find_block(blocks, 0x20)) == 2);
+	l_queue_destroy(blocks, block_destroy);
+
+	blocks = block_plan(plan->source_list, 16, plan->limits);
+	assert(l_queue_length(blocks) == 1);
+	assert(block_get_size(find_block(blocks, 0x10)) == 0x12);
+	l_queue_destroy(blocks, block_destroy);
+
+	plan_free(plan);
+}
+
+static void test_plan_split(const void *data)
+{
+	struct source sources[] = {
+		{ "q", HR, 0x10, 1000 },
+		{ "q", HR, 0x11, 2000 },
+		{ "b", MODBUS_TABLE_DISCRETE_INPUTS, 0x12, 1000 },
+		{ "q", HR, 0x10 + 125, 1000 },
+	};
+	struct test_plan *plan = plan_new(sources, L_ARRAY_SIZE(sources));
+	struct l_queue *blocks;
+
+	/* Intervals, tables and the PDU limit aren't merged */
+	blocks = block_plan(plan->source_list, 200, plan->limits);
+	assert(l_queue_length(blocks) == 4);
+	l_queue_destroy(blocks, block_destroy);
+
+	plan_free(plan);
+}
+
+static void gap_count(int table, uint16_t first, uint16_t last,
+		      void *user_data)
+{
+	unsigned int *count = user_data;
+
+	assert(table == HR);
+	assert((first == 0x11 && last == 0x11) ||
+	       (first == 0x13 && last == 0x1f));
+
+	(*count)++;
+}
+
+static void test_plan_hole(const void *data)
+{
+	struct source sources[] = {
+		{ "q", HR, 0x10, 1000 },
+		{ "q", HR, 0x12, 1000 },
+		{ "u", HR, 0x20, 1000 },
+	};
+	struct test_plan *plan = plan_new(sources, L_ARRAY_SIZE(sources));
+	struct l_queue *blocks;
+	unsigned int count = 0;
+
+	blocks = block_plan(plan->source_list, 16, plan->limits);
+	block_foreach_gap(find_block(blocks, 0x10), gap_count, &count);
+	assert(count == 2);
+	l_queue_destroy(blocks, block_destroy);
+
+	/* Suspected unreadable: not spanned anymore */
+	assert(devlimits_add_hole(plan->limits, HR, 0x18, 0x1b));
+	assert(!devlimits_add_hole(plan->limits, HR, 0x19, 0x19));
+
+	blocks = block_plan(plan->source_list, 16, plan->limits);
+	assert(l_queue_length(blocks) == 2);
+	assert(block_get_size(find_block(blocks, 0x10)) == 3);
+	assert(block_get_size(find_block(blocks, 0x20)) == 2);
+	l_queue_destroy(blocks, block_destroy);
+
+	/* Readable after all: merged again */
+	devlimits_remove_hole(plan->limits, HR, 0x18, 0x1b);
+	blocks = block_plan(plan->source_list, 16, plan->limits);
+	assert(l_queue_length(blocks) == 1);
+	l_queue_destroy(blocks, block_destroy);
+
+	/* Confirmed ranges are kept */
+	devlimits_add_hole(plan->limits, HR, 0x18, 0x1b);
+	devlimits_confirm_hole(plan->limits, HR, 0x18, 0x1b);
+	devlimits_remove_hole(plan->limits, HR, 0x18, 0x1b);
+	assert(!devlimits_is_readable(plan->limits, HR, 0x1b, 0x1b));
+
+	plan_free(plan);
+}
+
+static void test_plan_max(const void *data)
+{
+	struct source sources[] = {
+		{ "q", HR, 0x10, 1000 },
+		{ "q", HR, 0x11, 1000 },
+		{ "q", HR, 0x12, 1000 },
+	};
+	struct test_plan *plan = plan_new(sources, L_ARRAY_SIZE(sources));
+	struct l_queue *blocks;
+
+	assert(devlimits_shrink(plan->limits, HR, 2));
+	assert(!devlimits_shrink(plan->limits, HR, 4));
+
+	blocks = block_plan(plan->source_list, 0, plan->limits);
+	assert(l_queue_length(blocks) == 2);
+	assert(block_get_size(find_block(blocks, 0x10)) == 2);
+	assert(block_get_size(find_block(blocks, 0x12)) == 1);
+	l_queue_destroy(blocks, block_destroy);
+
+	plan_free(plan);
+}
+
+static void test_decode(const void *data)
+{
+	struct source sources[] = {
+		{ "q", HR, 0x10, 1000 },
+		{ "u", HR, 0x11, 1000 },
+	};
+	struct test_plan *plan = plan_new(sources, L_ARRAY_SIZE(sources));
+	struct l_queue *blocks;
+	struct block *block;
+
+	blocks = block_plan(plan->source_list, 0, plan->limits);
+	assert(l_queue_length(blocks) == 1);
+	block = find_block(blocks, 0x10);
+	assert(block_get_size(block) == 3);
+	plan_image(plan, blocks);
+
+	/* Only sources overlapping changed items are notified */
+	block_set(block, 0x10, 0x1234);
+	assert(block_decode(block, plan->image));
+	assert(sources[0].notified == 1 && sources[1].notified == 0);
+	assert(image_get_value(plan->image, HR, "q", 0x10) == 0x1234);
+
+	block_set(block, 0x12, 1);
+	assert(block_decode(block, plan->image));
+	assert(sources[0].notified == 1 && sources[1].notified == 1);
+
+	/* Unchanged response */
+	assert(!block_decode(block, plan->image));
+	assert(sources[0].notified == 1 && sources[1].notified == 1);
+
+	l_queue_destroy(blocks, block_destroy);
+	plan_free(plan);
+}
+
+static void test_decode_view(const void *data)
+{
+	struct source sources[] = {
+		{ "u", HR, 0x10, 1000 },
+		{ "q", HR, 0x11, 1000 },
+	};
+	struct test_plan *plan = plan_new(sources, L_ARRAY_SIZE(sources));
+	struct l_queue *blocks;
+	struct block *block;
+
+	/* The u16 within the u32 is decoded from the same reading */
+	blocks = block_plan(plan->source_list, 0, plan->limits);
+	assert(l_queue_length(blocks) == 1);
+	block = find_block(blocks, 0x10);
+	assert(block_get_size(block) == 2);
+	plan_image(plan, blocks);
+
+	block_set(block, 0x10, 1);
+	assert(block_decode(block, plan->image));
+	assert(sources[0].notified == 1 && sources[1].notified == 0);
+
+	block_set(block, 0x11, 2);
+	assert(block_decode(block, plan->image));
+	assert(sources[0].notified == 2 && sources[1].notified == 1);
+
+	/* Unchanged response */
+	assert(!block_decode(block, plan->image));
+	assert(sources[0].notified == 2 && sources[1].notified == 1);
+
+	l_queue_destroy(blocks, block_destroy);
+	plan_free(plan);
+}
+
+static void test_decode_overlap(const void *data)
+{
+	struct source sources[] = {
+		{ "u", HR, 0x10, 1000 },
+		{ "u", HR, 0x11, 2000 },
+	};
+	struct test_plan *plan = plan_new(sources, L_ARRAY_SIZE(sources));
+	struct l_queue *blocks;
+	struct block *fast;
+	struct block *slow;
+
+	/* Partially overlapping: none covers the other */
+	blocks = block_plan(plan->source_list, 0, plan->limits);
+	assert(l_queue_length(blocks) == 2);
+	fast = find_block(blocks, 0x10);
+	slow = find_block(blocks, 0x11);
+	plan_image(plan, blocks);
+
+	/* Shared item changed: the other block's source too */
+	block_set(fast, 0x11, 7);
+	assert(block_decode(fast, plan->image));
+	assert(sources[0].notified == 1 && sources[1].notified == 1);
+
+	/* Already notified: same value read by the slower block */
+	block_set(slow, 0x11, 7);
+	assert(!block_decode(slow, plan->image));
+	assert(sources[0].notified == 1 && sources[1].notified == 1);
+
+	/* Item not shared */
+	block_set(slow, 0x12, 3);
+	assert(block_decode(slow, plan->image));
+	assert(sources[0].notified == 1 && sources[1].notified == 2);
+
+	l_queue_destroy(blocks, block_destroy);
+	plan_free(plan);
+}
+
+static void test_decode_gap(const void *data)
+{
+	struct source sources[] = {
+		{ "q", HR, 0x10, 1000 },
+		{ "q", HR, 0x12, 1000 },
+	};
+	struct test_plan *plan = plan_new(sources, L_ARRAY_SIZE(sources));
+	struct l_queue *blocks;
+	struct block *block;
+
+	blocks = block_plan(plan->source_list, 1, plan->limits);
+	block = find_block(blocks, 0x10);
+	assert(block_get_size(block) == 3);
+	plan_image(plan, blocks);
+
+	/* Unused item changed: no source notified, range clean */
+	block_set(block, 0x11, 0xdead);
+	assert(!block_decode(block, plan->image));
+	assert(sources[0].notified == 0 && sources[1].notified == 0);
+	assert(!image_is_dirty(plan->image, HR, 0x10, 3));
+
+	block_set(block, 0x12, 1);
+	assert(block_decode(block, plan->image));
+	assert(sources[0].notified == 0 && sources[1].notified == 1);
+
+	l_queue_destroy(blocks, block_destroy);
+	plan_free(plan);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("Plan gap", test_plan_gap, NULL);
+	l_test_add("Plan split", test_plan_split, NULL);
+	l_test_add("Plan hole", test_plan_hole, NULL);
+	l_test_add("Plan max quantity", test_plan_max, NULL);
+	l_test_add("Decode", test_decode, NULL);
+	l_test_add("Decode view", test_decode_view, NULL);
+	l_test_add("Decode overlap", test_decode_overlap, NULL);
+	l_test_add("Decode gap", test_decode_gap, NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,105 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+
+#include <ell/ell.h>
+
+#include "src/image.h"
+
+#define DIFF_RUNS	100000
+
+/* Room for unaligned starts past the longest comparison */
+#define DIFF_LEN	(64 + 16)
+
+/* Few changes: most readings repeat the previous values */
+static void fill(uint16_t *old, uint16_t *new, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		old[i] = l_getrandom_uint32();
+		new[i] = (l_getrandom_uint32() % 4 ? old[i] :
+			  (uint16_t) l_getrandom_uint32());
+	}
+}
+
+static void test_random(const void *data)
+{
+	uint16_t old[DIFF_LEN];
+	uint16_t new[DIFF_LEN];
+	unsigned int offset;
+	unsigned int n;
+	unsigned int i;
+
+	for (i = 0; i < DIFF_RUNS; i++) {
+		fill(old, new, DIFF_LEN);
+		offset = l_getrandom_uint32() % 16;
+		n = l_getrandom_uint32() % 65;
+
+		assert(image_diff_registers(old + offset, new + offset, n) ==
+		       image_diff_registers_scalar(old + offset,
+						   new + offset, n));
+	}
+}
+
+static void test_lengths(const void *data)
+{
+	uint16_t old[DIFF_LEN];
+	uint16_t new[DIFF_LEN];
+	uint64_t mask;
+	unsigned int n;
+	unsigned int i;
+
+	/* Each length: vector blocks and every tail size */
+	for (n = 0; n <= 64; n++) {
+		for (i = 0; i < DIFF_LEN; i++)
+			old[i] = new[i] = i;
+
+		assert(image_diff_registers(old, new, n) == 0);
+
+		/* Single change at each position */
+		for (i = 0; i < n; i++) {
+			new[i] ^= 0x8000;
+			mask = image_diff_registers(old, new, n);
+			assert(mask == (uint64_t) 1 << i);
+			new[i] ^= 0x8000;
+		}
+
+		/* Changes past 'n' are ignored */
+		new[n] ^= 1;
+		assert(image_diff_registers(old, new, n) == 0);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("Diff random data", test_random, NULL);
+	l_test_add("Diff lengths and tails", test_lengths, NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,130 @@
+/*
+ * This file is part of the KNOT Project
+ *
+ * Copyright (c) 2019, CESAR. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+
+#include <ell/ell.h>
+
+#include "src/driver.h"
+#include "src/image.h"
+
+static void test_registers(const void *data)
+{
+	int table = MODBUS_TABLE_HOLDING_REGISTERS;
+	struct image *image = image_new();
+	uint16_t regs[4] = { 1, 2, 3, 4 };
+
+	image_resize(image, table, 0x10, 8);
+
+	/* First reading: changed from the initial zeros */
+	assert(image_update(image, table, 0x10, 4, regs));
+	assert(image_is_dirty(image, table, 0x10, 4));
+	assert(!image_is_dirty(image, table, 0x14, 4));
+	assert(image_get_value(image, table, "q", 0x12) == 3);
+
+	image_clean(image, table, 0x10, 4);
+	assert(!image_is_dirty(image, table, 0x10, 8));
+
+	/* Unchanged response */
+	assert(!image_update(image, table, 0x10, 4, regs));
+	assert(!image_is_dirty(image, table, 0x10, 8));
+
+	/* Only the changed item is flagged */
+	regs[2] = 0xffff;
+	assert(image_update(image, table, 0x10, 4, regs));
+	assert(!image_is_dirty(image, table, 0x10, 2));
+	assert(image_is_dirty(image, table, 0x12, 1));
+	assert(!image_is_dirty(image, table, 0x13, 1));
+	assert(image_get_value(image, table, "q", 0x12) == 0xffff);
+
+	/* Out of the image: not read yet */
+	assert(image_get_value(image, table, "q", 0x20) == 0);
+
+	image_free(image);
+}
+
+static void test_bits(const void *data)
+{
+	int table = MODBUS_TABLE_COILS;
+	struct image *image = image_new();
+	uint8_t bits[3] = { 0x81, 0x00, 0x01 };	/* LSB first */
+
+	/* 0x40: bit 61 of the image, the reading spans two words */
+	image_resize(image, table, 0x03, 80);
+
+	assert(image_update(image, table, 0x40, 17, bits));
+	assert(image_get_value(image, table, "b", 0x40) == 1);
+	assert(image_get_value(image, table, "b", 0x41) == 0);
+	assert(image_get_value(image, table, "b", 0x47) == 1);
+	assert(image_get_value(image, table, "b", 0x50) == 1);
+	assert(image_get_value(image, table, "y", 0x40) == 0x81);
+	assert(image_is_dirty(image, table, 0x40, 1));
+	assert(!image_is_dirty(image, table, 0x41, 6));
+	assert(!image_is_dirty(image, table, 0x03, 0x3d));
+
+	image_clean(image, table, 0x03, 80);
+	assert(!image_update(image, table, 0x40, 17, bits));
+
+	bits[2] = 0x00;
+	assert(image_update(image, table, 0x40, 17, bits));
+	assert(image_is_dirty(image, table, 0x50, 1));
+	assert(!image_is_dirty(image, table, 0x40, 16));
+	assert(image_get_value(image, table, "b", 0x50) == 0);
+
+	image_free(image);
+}
+
+static void test_resize(const void *data)
+{
+	int table = MODBUS_TABLE_INPUT_REGISTERS;
+	struct image *image = image_new();
+	uint16_t regs[4] = { 10, 11, 12, 13 };
+
+	image_resize(image, table, 0x100, 4);
+	image_update(image, table, 0x100, 4, regs);
+
+	/* Overlapping values are kept, new items read as zero */
+	image_resize(image, table, 0x102, 4);
+	assert(image_get_value(image, table, "q", 0x102) == 12);
+	assert(image_get_value(image, table, "q", 0x103) == 13);
+	assert(image_get_value(image, table, "q", 0x104) == 0);
+	assert(image_get_value(image, table, "q", 0x100) == 0);
+
+	/* Kept values don't change again */
+	assert(!image_update(image, table, 0x102, 2, &regs[2]));
+
+	image_free(image);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("Image registers", test_registers, NULL);
+	l_test_add("Image bits", test_bits, NULL);
+	l_test_add("Image resize", test_resize, NULL);
+
+	return l_test_run();
+}